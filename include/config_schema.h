@@ -0,0 +1,100 @@
+// Typed configuration schema and its binary form
+//
+// A schema is a constexpr table of config_field_t. The firmware keeps
+// config.json and SPIFFS access to itself and leaves defaults, validation
+// and the binary config.bin to these functions. test/test_config_schema
+// runs them against a table of its own.
+//
+// config.bin is a header with magic, version, length and CRC32, then one
+// id, length, value record per field. Unknown ids are skipped and missing
+// ones keep their default, so fields can be added without a new version.
+#ifndef CONFIG_SCHEMA_H
+#define CONFIG_SCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// types
+#define CONFIG_STRING 0
+#define CONFIG_UINT 1
+#define CONFIG_BOOL 2
+
+#define CONFIG_MAGIC 0x47464345  // "ECFG"
+#define CONFIG_VERSION 1
+#define CONFIG_STRING_MAX 64
+
+typedef struct {
+  uint8_t id;           // record id in config.bin, never reuse one
+  const char *section;  // NULL for top level keys
+  const char *key;
+  const char *name;     // for the config command
+  uint8_t type;
+  void *value;
+  const char *def;      // default of strings
+  uint32_t def_num;     // default of numbers and flags
+  uint32_t min, max;    // range of numbers, length of strings
+  void (*apply)(void);  // puts a runtime change into effect, NULL if none
+} config_field_t;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t len;  // bytes of records following
+  uint32_t crc;  // of the records
+} config_header_t;
+
+// a table and how to reach strings in it, they are kept in the
+// application's string type, Arduino String on the device
+typedef struct {
+  const config_field_t *fields;
+  size_t count;
+  const char *(*string_get)(const void *value);
+  void (*string_set)(void *value, const char *s);
+} config_schema_t;
+
+// CRC-32 as in zlib, the same as crc32_le(0, ...) of the ESP32 ROM
+uint32_t config_crc32(const uint8_t *data, size_t len);
+
+void config_defaults(const config_schema_t *s);
+const config_field_t *config_find(const config_schema_t *s, const char *name);
+const config_field_t *config_find_id(const config_schema_t *s, uint8_t id);
+
+// run every distinct apply hook once, after many fields may have changed
+void config_apply_all(const config_schema_t *s);
+
+// set a field from text as found in JSON or the config command
+bool config_parse(const config_schema_t *s, const config_field_t *c, const char *text);
+
+// binary form of all fields, 0 if it does not fit into size
+size_t config_encode(const config_schema_t *s, uint8_t *buf, size_t size);
+
+// set the fields from a binary form, -1 if it is broken, else the number
+// of records with invalid values, which keep the value they had
+int config_decode(const config_schema_t *s, const uint8_t *buf, size_t size);
+
+// compile time checks of a schema, for static_assert
+constexpr size_t config_strlen(const char *s) {
+  return *s ? 1 + config_strlen(s + 1) : 0;
+}
+
+template <size_t N>
+constexpr bool config_id_unused(const config_field_t (&f)[N], size_t i, size_t j) {
+  return j >= N || (f[j].id != f[i].id && config_id_unused(f, i, j + 1));
+}
+
+template <size_t N>
+constexpr bool config_ids_unique(const config_field_t (&f)[N], size_t i = 0) {
+  return i >= N || (config_id_unused(f, i, i + 1) && config_ids_unique(f, i + 1));
+}
+
+template <size_t N>
+constexpr bool config_defaults_valid(const config_field_t (&f)[N], size_t i = 0) {
+  return i >= N ||
+    ((f[i].type == CONFIG_STRING ?
+      f[i].def && f[i].max <= CONFIG_STRING_MAX &&
+      config_strlen(f[i].def) >= f[i].min && config_strlen(f[i].def) <= f[i].max :
+      f[i].def_num >= f[i].min && f[i].def_num <= f[i].max) &&
+     config_defaults_valid(f, i + 1));
+}
+
+#endif
@@ -0,0 +1,49 @@
+// Sequencing of the duty cycled low power mode
+//
+// The firmware performs the action returned by duty_next() and reports
+// back whether it worked; test/test_duty_cycle walks every path through a
+// wake cycle this way.
+//
+//   read sensors -> connect (fast path, else full scan) -> MQTT
+//     -> publish queued data -> snapshot, if due -> sleep
+//
+// Any failed connection step goes straight to sleep, the readings stay
+// queued for the next cycle. A failed fast path falls back to a full
+// connect and is not tried again until a full connect succeeded.
+#ifndef DUTY_CYCLE_H
+#define DUTY_CYCLE_H
+
+#include <stdint.h>
+
+// actions
+#define DUTY_READ_SENSORS 0
+#define DUTY_CONNECT_FAST 1
+#define DUTY_CONNECT_FULL 2
+#define DUTY_CONNECT_MQTT 3
+#define DUTY_PUBLISH 4
+#define DUTY_SNAPSHOT 5
+#define DUTY_SLEEP 6
+
+// events
+#define DUTY_START 0
+#define DUTY_OK 1
+#define DUTY_FAIL 2
+
+typedef struct {
+  uint8_t state;            // action in progress
+  bool fast_valid;          // stored BSSID, channel and IP are usable
+  uint8_t snapshot_every;   // cycles between snapshots, 0 for none
+  uint32_t cycle;
+  uint32_t failed_connects; // consecutive cycles without broker
+} duty_cycle_t;
+
+void duty_init(duty_cycle_t *d, uint8_t snapshot_every);
+
+// next action after event, DUTY_START begins a new wake cycle
+int duty_next(duty_cycle_t *d, int event);
+
+// microseconds to sleep so cycles start every interval_s seconds; every
+// cycle without broker doubles the period, up to 16 intervals
+uint64_t duty_sleep_us(const duty_cycle_t *d, uint32_t interval_s, uint32_t awake_ms);
+
+#endif
@@ -0,0 +1,34 @@
+// Baseline JPEG encoder for raw camera frames
+//
+// Integer DCT, standard Huffman tables and quantization tables prescaled
+// for the common quality levels 50, 75, 80 and 90, other levels are scaled
+// when the encoder starts. YUV422 frames are encoded without an RGB round
+// trip. Output is collected in a caller provided buffer and handed to the
+// callback whenever it is full and after every row of MCUs.
+//
+// test/test_jpeg_encoder decodes the output and compares it with the input
+// and the IJG tables, tools/jpeg_bench.cpp measures it against libjpeg.
+#ifndef JPEG_ENCODER_H
+#define JPEG_ENCODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define JPEG_GRAYSCALE 0
+#define JPEG_YUV422 1    // Y0 U Y1 V, as delivered by the camera
+#define JPEG_RGB565 2    // big endian, as delivered by the camera
+
+// same signature as jpg_out_cb of the camera driver, returns len on success
+typedef size_t (*jpeg_out_cb)(void *arg, size_t index, const void *data, size_t len);
+
+// encode one frame, buf must hold at least 256 bytes, returns false if the
+// format is not supported or the callback failed
+bool jpeg_encode(const uint8_t *src, uint16_t width, uint16_t height, int format,
+  uint8_t quality, uint8_t *buf, size_t size, jpeg_out_cb cb, void *arg);
+
+// nearest neighbour downscale by 1/scale for thumbnails, YUV422 keeps whole
+// Y0 U Y1 V pairs, returns false if the result does not fit into size
+bool jpeg_subsample(const uint8_t *src, uint16_t width, uint16_t height, int format,
+  uint8_t scale, uint8_t *out, size_t size, uint16_t *out_width, uint16_t *out_height);
+
+#endif
@@ -0,0 +1,70 @@
+// RTSP request parsing and RTP/JPEG packetization (RFC 2435)
+//
+// Shared by the firmware, the unit tests in test/test_rtsp_jpeg and the
+// host server in tools/rtsp_server.cpp, which streams JPEG files.
+//
+// The packetizer does not copy the scan data: for every packet it hands the
+// RTP and JPEG headers and a pointer into the original JPEG buffer to a
+// callback, which writes both to the socket.
+#ifndef RTSP_JPEG_H
+#define RTSP_JPEG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RTP_PAYLOAD_JPEG 26
+#define RTP_HEADER_LEN 12
+#define RTP_JPEG_HEADER_LEN 8
+#define RTP_JPEG_MAX_HEADER (4 + RTP_HEADER_LEN + RTP_JPEG_HEADER_LEN + 4 + 4 + 128)
+#define RTP_CLOCK 90000
+
+typedef struct {
+  uint16_t width;
+  uint16_t height;
+  uint8_t type;               // RFC 2435 type, 0 = 4:2:2, 1 = 4:2:0, +64 with restart markers
+  uint16_t restart_interval;
+  const uint8_t *qtables[2];  // luma and chroma, 64 bytes each
+  const uint8_t *scan;        // entropy coded data, up to but without EOI
+  size_t scan_len;
+} rtp_jpeg_frame_t;
+
+typedef struct {
+  uint16_t seq;
+  uint32_t ssrc;
+  int interleaved;            // RTSP interleaved channel, -1 for UDP
+} rtp_session_t;
+
+// called once per packet, returns false to abort the frame
+typedef bool (*rtp_send_cb)(void *arg, const uint8_t *header, size_t header_len,
+  const uint8_t *payload, size_t payload_len);
+
+// locate tables and scan data in a baseline JPEG, false if unsupported
+bool rtp_jpeg_parse(const uint8_t *jpg, size_t len, rtp_jpeg_frame_t *f);
+
+// send one frame, mtu is the maximum RTP packet size without the
+// interleave prefix, returns the number of packets or -1
+int rtp_jpeg_send(rtp_session_t *s, const rtp_jpeg_frame_t *f, uint32_t timestamp,
+  size_t mtu, rtp_send_cb cb, void *arg);
+
+// RTP timestamp from a capture time
+uint32_t rtp_timestamp(uint32_t sec, uint32_t usec);
+
+#define RTSP_OPTIONS 1
+#define RTSP_DESCRIBE 2
+#define RTSP_SETUP 3
+#define RTSP_PLAY 4
+#define RTSP_TEARDOWN 5
+#define RTSP_UNKNOWN 0
+
+typedef struct {
+  int method;
+  int cseq;
+  bool tcp;                   // RTP/AVP/TCP transport requested
+  uint16_t client_port[2];    // UDP RTP and RTCP port
+  uint8_t interleaved[2];     // TCP RTP and RTCP channel
+} rtsp_request_t;
+
+// parse a complete request header, false if malformed
+bool rtsp_parse_request(const char *buf, size_t len, rtsp_request_t *r);
+
+#endif
@@ -0,0 +1,69 @@
+// Compact binary encoding for sensor telemetry
+//
+// A subscriber on the host decodes with the same code, see
+// tools/telemetry_decode.cpp; tools/telemetry_bench.cpp measures the bytes
+// per reading against the text topics, test/test_telemetry_codec runs it
+// in the native environment.
+//
+// Packet layout, version 2:
+//   byte 0     version << 4 | flags (TELEMETRY_KEYFRAME)
+//   byte 1     packet sequence number, wraps at 256
+//   byte 2     bitmask of the channels present, bit n = channel n
+//   byte 3     schema, a hash of the scale and delta of every channel
+//   then       one zigzag varint per channel present, in channel order
+//
+// Scale and delta can change at runtime. A decoder whose channel table
+// gives another schema refuses the packet instead of mis-scaling it.
+//
+// Every value is quantized to round(value * scale). Keyframes carry the
+// quantized values, other packets the difference to the previous value of
+// the channel, unless delta is disabled for that channel. A packet that
+// carries a channel for the first time is always a keyframe. After a lost
+// packet the decoder drops delta values until the next keyframe.
+#ifndef TELEMETRY_CODEC_H
+#define TELEMETRY_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TELEMETRY_VERSION 2
+#define TELEMETRY_KEYFRAME 0x01
+#define TELEMETRY_MAX_CHANNELS 8
+#define TELEMETRY_HEADER_LEN 4
+#define TELEMETRY_MAX_PACKET (TELEMETRY_HEADER_LEN + TELEMETRY_MAX_CHANNELS * 5)
+
+typedef struct {
+  const char *name;
+  float scale;   // quantization, 100 means a resolution of 0.01
+  bool delta;    // send differences to the previous value
+} telemetry_channel_t;
+
+typedef struct {
+  const telemetry_channel_t *channels;
+  uint8_t count;
+  uint8_t keyframe_interval;  // every n-th packet is a keyframe
+  uint8_t seq;                // next sequence number
+  uint8_t known;              // channels with a valid previous value
+  uint8_t schema;             // of the channel table at the last reset
+  int32_t last[TELEMETRY_MAX_CHANNELS];
+} telemetry_state_t;
+
+void telemetry_init(telemetry_state_t *s, const telemetry_channel_t *channels,
+  uint8_t count, uint8_t keyframe_interval);
+
+// force the next packet to be a keyframe, call it after changing the
+// channel table
+void telemetry_reset(telemetry_state_t *s);
+
+// encode the channels set in mask, returns the packet length or 0
+size_t telemetry_encode(telemetry_state_t *s, const float *values, uint8_t mask,
+  uint8_t *buf, size_t size);
+
+// decode a packet into values, returns the mask of channels decoded,
+// which is 0 while waiting for a keyframe, -1 for a malformed packet or
+// TELEMETRY_OTHER_SCHEMA if it was encoded with other channel settings
+#define TELEMETRY_OTHER_SCHEMA -2
+int telemetry_decode(telemetry_state_t *s, const uint8_t *buf, size_t len,
+  float *values);
+
+#endif
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "config_schema.h"
+
+uint32_t config_crc32(const uint8_t *data, size_t len) {
+  uint32_t crc = 0xffffffff;
+
+  while (len--) {
+    crc ^= *data++;
+    for (int b = 0; b < 8; b++)
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+void config_defaults(const config_schema_t *s) {
+  for (size_t i = 0; i < s->count; i++) {
+    const config_field_t *c = &s->fields[i];
+    if (c->type == CONFIG_STRING)
+      s->string_set(c->value, c->def);
+    else if (c->type == CONFIG_UINT)
+      *(unsigned int *)c->value = c->def_num;
+    else
+      *(bool *)c->value = c->def_num;
+  }
+}
+
+const config_field_t *config_find(const config_schema_t *s, const char *name) {
+  for (size_t i = 0; i < s->count; i++) {
+    if (!strcmp(s->fields[i].name, name))
+      return &s->fields[i];
+  }
+  return NULL;
+}
+
+const config_field_t *config_find_id(const config_schema_t *s, uint8_t id) {
+  for (size_t i = 0; i < s->count; i++) {
+    if (s->fields[i].id == id)
+      return &s->fields[i];
+  }
+  return NULL;
+}
+
+void config_apply_all(const config_schema_t *s) {
+  for (size_t i = 0; i < s->count; i++) {
+    size_t j = 0;
+    while (j < i && s->fields[j].apply != s->fields[i].apply)
+      j++;
+    if (s->fields[i].apply && j == i)
+      s->fields[i].apply();
+  }
+}
+
+bool config_parse(const config_schema_t *s, const config_field_t *c, const char *text) {
+  if (c->type == CONFIG_STRING) {
+    size_t len = strlen(text);
+    if (len < c->min || len > c->max)
+      return false;
+    s->string_set(c->value, text);
+  } else if (c->type == CONFIG_BOOL) {
+    if (!strcmp(text, "true") || !strcmp(text, "on") || !strcmp(text, "1"))
+      *(bool *)c->value = true;
+    else if (!strcmp(text, "false") || !strcmp(text, "off") || !strcmp(text, "0"))
+      *(bool *)c->value = false;
+    else
+      return false;
+  } else {
+    char *end;
+    unsigned long n = strtoul(text, &end, 10);
+    if (end == text || *end || n < c->min || n > c->max)
+      return false;
+    *(unsigned int *)c->value = n;
+  }
+  return true;
+}
+
+// set a field from one record
+static bool config_decode_field(const config_schema_t *s, const config_field_t *c,
+  const uint8_t *data, uint8_t len) {
+  if (c->type == CONFIG_STRING) {
+    char text[CONFIG_STRING_MAX + 1];
+    if (len < c->min || len > c->max || len > CONFIG_STRING_MAX)
+      return false;
+    memcpy(text, data, len);
+    text[len] = 0;
+    s->string_set(c->value, text);
+  } else if (c->type == CONFIG_BOOL) {
+    if (len != 1 || data[0] > 1)
+      return false;
+    *(bool *)c->value = data[0];
+  } else {
+    uint32_t n;
+    if (len != sizeof(n))
+      return false;
+    memcpy(&n, data, sizeof(n));
+    if (n < c->min || n > c->max)
+      return false;
+    *(unsigned int *)c->value = n;
+  }
+  return true;
+}
+
+size_t config_encode(const config_schema_t *s, uint8_t *buf, size_t size) {
+  config_header_t h;
+  size_t len = sizeof(h);
+
+  for (size_t i = 0; i < s->count; i++) {
+    const config_field_t *c = &s->fields[i];
+    const uint8_t *data;
+    uint32_t n;
+    size_t field_len;
+    if (c->type == CONFIG_STRING) {
+      data = (const uint8_t *)s->string_get(c->value);
+      field_len = strlen((const char *)data);
+      if (field_len > c->max)
+        field_len = c->max;
+    } else {
+      n = c->type == CONFIG_BOOL ? *(bool *)c->value : *(unsigned int *)c->value;
+      data = (const uint8_t *)&n;
+      field_len = c->type == CONFIG_BOOL ? 1 : sizeof(n);
+    }
+    if (len + 2 + field_len > size)
+      return 0;
+    buf[len++] = c->id;
+    buf[len++] = field_len;
+    memcpy(buf + len, data, field_len);
+    len += field_len;
+  }
+  h.magic = CONFIG_MAGIC;
+  h.version = CONFIG_VERSION;
+  h.len = len - sizeof(h);
+  h.crc = config_crc32(buf + sizeof(h), h.len);
+  memcpy(buf, &h, sizeof(h));
+  return len;
+}
+
+int config_decode(const config_schema_t *s, const uint8_t *buf, size_t size) {
+  config_header_t h;
+  int invalid = 0;
+
+  if (size < sizeof(h))
+    return -1;
+  memcpy(&h, buf, sizeof(h));
+  if (h.magic != CONFIG_MAGIC || h.version != CONFIG_VERSION || h.len != size - sizeof(h) ||
+      config_crc32(buf + sizeof(h), h.len) != h.crc)
+    return -1;
+
+  size_t pos = sizeof(h);
+  while (pos + 2 <= size && pos + 2 + buf[pos + 1] <= size) {
+    // ids we do not know come from a newer firmware
+    const config_field_t *c = config_find_id(s, buf[pos]);
+    if (c && !config_decode_field(s, c, buf + pos + 2, buf[pos + 1]))
+      invalid++;
+    pos += 2 + buf[pos + 1];
+  }
+  return invalid;
+}
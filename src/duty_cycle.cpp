@@ -0,0 +1,68 @@
+#include "duty_cycle.h"
+
+#define DUTY_MAX_BACKOFF 4  // sleep at most 2^4 intervals while offline
+
+void duty_init(duty_cycle_t *d, uint8_t snapshot_every) {
+  d->state = DUTY_SLEEP;
+  d->fast_valid = false;
+  d->snapshot_every = snapshot_every;
+  d->cycle = 0;
+  d->failed_connects = 0;
+}
+
+static int duty_connected_fail(duty_cycle_t *d) {
+  d->failed_connects++;
+  return DUTY_SLEEP;
+}
+
+static int duty_decide(duty_cycle_t *d, int event) {
+  bool ok = (event == DUTY_OK);
+
+  if (event == DUTY_START) {
+    d->cycle++;
+    return DUTY_READ_SENSORS;
+  }
+
+  switch (d->state) {
+    case DUTY_READ_SENSORS:
+      // readings are queued either way, now get them out
+      return d->fast_valid ? DUTY_CONNECT_FAST : DUTY_CONNECT_FULL;
+    case DUTY_CONNECT_FAST:
+      if (ok)
+        return DUTY_CONNECT_MQTT;
+      d->fast_valid = false;
+      return DUTY_CONNECT_FULL;
+    case DUTY_CONNECT_FULL:
+      if (!ok)
+        return duty_connected_fail(d);
+      d->fast_valid = true;
+      return DUTY_CONNECT_MQTT;
+    case DUTY_CONNECT_MQTT:
+      if (!ok)
+        return duty_connected_fail(d);
+      d->failed_connects = 0;
+      return DUTY_PUBLISH;
+    case DUTY_PUBLISH:
+      if (ok && d->snapshot_every && (d->cycle % d->snapshot_every) == 0)
+        return DUTY_SNAPSHOT;
+      return DUTY_SLEEP;
+    default:
+      return DUTY_SLEEP;
+  }
+}
+
+int duty_next(duty_cycle_t *d, int event) {
+  if (event != DUTY_START && d->state == DUTY_SLEEP)
+    return DUTY_SLEEP;
+  d->state = duty_decide(d, event);
+  return d->state;
+}
+
+uint64_t duty_sleep_us(const duty_cycle_t *d, uint32_t interval_s, uint32_t awake_ms) {
+  uint32_t backoff = d->failed_connects > DUTY_MAX_BACKOFF ? DUTY_MAX_BACKOFF : d->failed_connects;
+  uint64_t period_ms = (uint64_t)interval_s * 1000 << backoff;
+
+  if (awake_ms + 1000 > period_ms)
+    return 1000000;  // at least a second
+  return (period_ms - awake_ms) * 1000;
+}
@@ -0,0 +1,632 @@
+#include "jpeg_encoder.h"
+
+#include <string.h>
+
+static const uint8_t zigzag[64] = {
+  0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Annex K tables, codes are (length << 16) | code
+static const uint8_t dc_luma_bits[16] = {
+  0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0,
+};
+static const uint8_t dc_chroma_bits[16] = {
+  0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+};
+static const uint8_t dc_vals[12] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+};
+static const uint8_t ac_luma_bits[16] = {
+  0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7d,
+};
+static const uint8_t ac_luma_vals[162] = {
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06,
+  0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+  0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+  0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+  0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+  0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+  0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+  0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+  0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+  0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4,
+  0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+};
+static const uint8_t ac_chroma_bits[16] = {
+  0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77,
+};
+static const uint8_t ac_chroma_vals[162] = {
+  0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+  0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+  0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+  0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+  0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+  0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+  0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+  0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+  0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+  0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+  0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+  0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4,
+  0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+};
+static const uint32_t dc_luma_codes[12] = {
+  0x20000, 0x30002, 0x30003, 0x30004, 0x30005, 0x30006,
+  0x4000e, 0x5001e, 0x6003e, 0x7007e, 0x800fe, 0x901fe,
+};
+static const uint32_t dc_chroma_codes[12] = {
+  0x20000, 0x20001, 0x20002, 0x30006, 0x4000e, 0x5001e,
+  0x6003e, 0x7007e, 0x800fe, 0x901fe, 0xa03fe, 0xb07fe,
+};
+static const uint32_t ac_luma_codes[256] = {
+  0x4000a, 0x20000, 0x20001, 0x30004, 0x4000b, 0x5001a, 0x70078, 0x800f8,
+  0xa03f6, 0x10ff82, 0x10ff83, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x4000c, 0x5001b, 0x70079, 0x901f6, 0xb07f6, 0x10ff84, 0x10ff85,
+  0x10ff86, 0x10ff87, 0x10ff88, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x5001c, 0x800f9, 0xa03f7, 0xc0ff4, 0x10ff89, 0x10ff8a, 0x10ff8b,
+  0x10ff8c, 0x10ff8d, 0x10ff8e, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x6003a, 0x901f7, 0xc0ff5, 0x10ff8f, 0x10ff90, 0x10ff91, 0x10ff92,
+  0x10ff93, 0x10ff94, 0x10ff95, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x6003b, 0xa03f8, 0x10ff96, 0x10ff97, 0x10ff98, 0x10ff99, 0x10ff9a,
+  0x10ff9b, 0x10ff9c, 0x10ff9d, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x7007a, 0xb07f7, 0x10ff9e, 0x10ff9f, 0x10ffa0, 0x10ffa1, 0x10ffa2,
+  0x10ffa3, 0x10ffa4, 0x10ffa5, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x7007b, 0xc0ff6, 0x10ffa6, 0x10ffa7, 0x10ffa8, 0x10ffa9, 0x10ffaa,
+  0x10ffab, 0x10ffac, 0x10ffad, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x800fa, 0xc0ff7, 0x10ffae, 0x10ffaf, 0x10ffb0, 0x10ffb1, 0x10ffb2,
+  0x10ffb3, 0x10ffb4, 0x10ffb5, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x901f8, 0xf7fc0, 0x10ffb6, 0x10ffb7, 0x10ffb8, 0x10ffb9, 0x10ffba,
+  0x10ffbb, 0x10ffbc, 0x10ffbd, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x901f9, 0x10ffbe, 0x10ffbf, 0x10ffc0, 0x10ffc1, 0x10ffc2, 0x10ffc3,
+  0x10ffc4, 0x10ffc5, 0x10ffc6, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x901fa, 0x10ffc7, 0x10ffc8, 0x10ffc9, 0x10ffca, 0x10ffcb, 0x10ffcc,
+  0x10ffcd, 0x10ffce, 0x10ffcf, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0xa03f9, 0x10ffd0, 0x10ffd1, 0x10ffd2, 0x10ffd3, 0x10ffd4, 0x10ffd5,
+  0x10ffd6, 0x10ffd7, 0x10ffd8, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0xa03fa, 0x10ffd9, 0x10ffda, 0x10ffdb, 0x10ffdc, 0x10ffdd, 0x10ffde,
+  0x10ffdf, 0x10ffe0, 0x10ffe1, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0xb07f8, 0x10ffe2, 0x10ffe3, 0x10ffe4, 0x10ffe5, 0x10ffe6, 0x10ffe7,
+  0x10ffe8, 0x10ffe9, 0x10ffea, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x10ffeb, 0x10ffec, 0x10ffed, 0x10ffee, 0x10ffef, 0x10fff0, 0x10fff1,
+  0x10fff2, 0x10fff3, 0x10fff4, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0xb07f9, 0x10fff5, 0x10fff6, 0x10fff7, 0x10fff8, 0x10fff9, 0x10fffa, 0x10fffb,
+  0x10fffc, 0x10fffd, 0x10fffe, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+};
+static const uint32_t ac_chroma_codes[256] = {
+  0x20000, 0x20001, 0x30004, 0x4000a, 0x50018, 0x50019, 0x60038, 0x70078,
+  0x901f4, 0xa03f6, 0xc0ff4, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x4000b, 0x60039, 0x800f6, 0x901f5, 0xb07f6, 0xc0ff5, 0x10ff88,
+  0x10ff89, 0x10ff8a, 0x10ff8b, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x5001a, 0x800f7, 0xa03f7, 0xc0ff6, 0xf7fc2, 0x10ff8c, 0x10ff8d,
+  0x10ff8e, 0x10ff8f, 0x10ff90, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x5001b, 0x800f8, 0xa03f8, 0xc0ff7, 0x10ff91, 0x10ff92, 0x10ff93,
+  0x10ff94, 0x10ff95, 0x10ff96, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x6003a, 0x901f6, 0x10ff97, 0x10ff98, 0x10ff99, 0x10ff9a, 0x10ff9b,
+  0x10ff9c, 0x10ff9d, 0x10ff9e, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x6003b, 0xa03f9, 0x10ff9f, 0x10ffa0, 0x10ffa1, 0x10ffa2, 0x10ffa3,
+  0x10ffa4, 0x10ffa5, 0x10ffa6, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x70079, 0xb07f7, 0x10ffa7, 0x10ffa8, 0x10ffa9, 0x10ffaa, 0x10ffab,
+  0x10ffac, 0x10ffad, 0x10ffae, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x7007a, 0xb07f8, 0x10ffaf, 0x10ffb0, 0x10ffb1, 0x10ffb2, 0x10ffb3,
+  0x10ffb4, 0x10ffb5, 0x10ffb6, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x800f9, 0x10ffb7, 0x10ffb8, 0x10ffb9, 0x10ffba, 0x10ffbb, 0x10ffbc,
+  0x10ffbd, 0x10ffbe, 0x10ffbf, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x901f7, 0x10ffc0, 0x10ffc1, 0x10ffc2, 0x10ffc3, 0x10ffc4, 0x10ffc5,
+  0x10ffc6, 0x10ffc7, 0x10ffc8, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x901f8, 0x10ffc9, 0x10ffca, 0x10ffcb, 0x10ffcc, 0x10ffcd, 0x10ffce,
+  0x10ffcf, 0x10ffd0, 0x10ffd1, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x901f9, 0x10ffd2, 0x10ffd3, 0x10ffd4, 0x10ffd5, 0x10ffd6, 0x10ffd7,
+  0x10ffd8, 0x10ffd9, 0x10ffda, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0x901fa, 0x10ffdb, 0x10ffdc, 0x10ffdd, 0x10ffde, 0x10ffdf, 0x10ffe0,
+  0x10ffe1, 0x10ffe2, 0x10ffe3, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0xb07f9, 0x10ffe4, 0x10ffe5, 0x10ffe6, 0x10ffe7, 0x10ffe8, 0x10ffe9,
+  0x10ffea, 0x10ffeb, 0x10ffec, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0x00000, 0xe3fe0, 0x10ffed, 0x10ffee, 0x10ffef, 0x10fff0, 0x10fff1, 0x10fff2,
+  0x10fff3, 0x10fff4, 0x10fff5, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+  0xa03fa, 0xf7fc3, 0x10fff6, 0x10fff7, 0x10fff8, 0x10fff9, 0x10fffa, 0x10fffb,
+  0x10fffc, 0x10fffd, 0x10fffe, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000,
+};
+
+// Annex K quantization tables in natural order, scaled the IJG way
+static const uint8_t quant_luma_q50[64] = {
+  16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+  14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+  18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+  49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+};
+static const uint8_t quant_chroma_q50[64] = {
+  17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+  24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+};
+static const uint8_t quant_luma_q75[64] = {
+  8, 6, 5, 8, 12, 20, 26, 31, 6, 6, 7, 10, 13, 29, 30, 28,
+  7, 7, 8, 12, 20, 29, 35, 28, 7, 9, 11, 15, 26, 44, 40, 31,
+  9, 11, 19, 28, 34, 55, 52, 39, 12, 18, 28, 32, 41, 52, 57, 46,
+  25, 32, 39, 44, 52, 61, 60, 51, 36, 46, 48, 49, 56, 50, 52, 50,
+};
+static const uint8_t quant_chroma_q75[64] = {
+  9, 9, 12, 24, 50, 50, 50, 50, 9, 11, 13, 33, 50, 50, 50, 50,
+  12, 13, 28, 50, 50, 50, 50, 50, 24, 33, 50, 50, 50, 50, 50, 50,
+  50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
+  50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
+};
+static const uint8_t quant_luma_q80[64] = {
+  6, 4, 4, 6, 10, 16, 20, 24, 5, 5, 6, 8, 10, 23, 24, 22,
+  6, 5, 6, 10, 16, 23, 28, 22, 6, 7, 9, 12, 20, 35, 32, 25,
+  7, 9, 15, 22, 27, 44, 41, 31, 10, 14, 22, 26, 32, 42, 45, 37,
+  20, 26, 31, 35, 41, 48, 48, 40, 29, 37, 38, 39, 45, 40, 41, 40,
+};
+static const uint8_t quant_chroma_q80[64] = {
+  7, 7, 10, 19, 40, 40, 40, 40, 7, 8, 10, 26, 40, 40, 40, 40,
+  10, 10, 22, 40, 40, 40, 40, 40, 19, 26, 40, 40, 40, 40, 40, 40,
+  40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
+  40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
+};
+static const uint8_t quant_luma_q90[64] = {
+  3, 2, 2, 3, 5, 8, 10, 12, 2, 2, 3, 4, 5, 12, 12, 11,
+  3, 3, 3, 5, 8, 11, 14, 11, 3, 3, 4, 6, 10, 17, 16, 12,
+  4, 4, 7, 11, 14, 22, 21, 15, 5, 7, 11, 13, 16, 21, 23, 18,
+  10, 13, 16, 17, 21, 24, 24, 20, 14, 18, 19, 20, 22, 20, 21, 20,
+};
+static const uint8_t quant_chroma_q90[64] = {
+  3, 4, 5, 9, 20, 20, 20, 20, 4, 4, 5, 13, 20, 20, 20, 20,
+  5, 5, 11, 20, 20, 20, 20, 20, 9, 13, 20, 20, 20, 20, 20, 20,
+  20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+  20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+};
+
+typedef struct {
+  uint8_t *buf;
+  size_t size;
+  size_t len;
+  size_t total;
+  jpeg_out_cb cb;
+  void *arg;
+  bool failed;
+  uint32_t bits;
+  int nbits;
+  int dc[3];
+  uint8_t qt[2][64];        // natural order
+  uint16_t recip[2][64];    // zigzag order, 2^16 / (8 * q)
+} jpeg_writer_t;
+
+static void flush(jpeg_writer_t *w) {
+  if (w->len && !w->failed) {
+    if (w->cb(w->arg, w->total, w->buf, w->len) != w->len)
+      w->failed = true;
+    w->total += w->len;
+  }
+  w->len = 0;
+}
+
+static inline void put_byte(jpeg_writer_t *w, uint8_t c) {
+  if (w->len == w->size)
+    flush(w);
+  w->buf[w->len++] = c;
+}
+
+static void put_marker(jpeg_writer_t *w, uint8_t marker, uint16_t len) {
+  put_byte(w, 0xff);
+  put_byte(w, marker);
+  put_byte(w, len >> 8);
+  put_byte(w, len & 0xff);
+}
+
+static inline void put_bits(jpeg_writer_t *w, uint32_t code, int len) {
+  w->bits = (w->bits << len) | code;
+  w->nbits += len;
+  while (w->nbits >= 8) {
+    uint8_t c = w->bits >> (w->nbits - 8);
+    put_byte(w, c);
+    if (c == 0xff)
+      put_byte(w, 0);
+    w->nbits -= 8;
+  }
+}
+
+static inline void put_code(jpeg_writer_t *w, uint32_t code) {
+  put_bits(w, code & 0xffff, code >> 16);
+}
+
+static void scale_quant(uint8_t *out, const uint8_t *base, uint8_t quality) {
+  int s = quality < 50 ? 5000 / quality : 200 - quality * 2;
+  for (int i = 0; i < 64; i++) {
+    int q = (base[i] * s + 50) / 100;
+    out[i] = q < 1 ? 1 : q > 255 ? 255 : q;
+  }
+}
+
+static void setup_quant(jpeg_writer_t *w, uint8_t quality) {
+  if (quality < 1)
+    quality = 1;
+  if (quality > 100)
+    quality = 100;
+
+  switch (quality) {
+    case 50:
+      memcpy(w->qt[0], quant_luma_q50, 64);
+      memcpy(w->qt[1], quant_chroma_q50, 64);
+      break;
+    case 75:
+      memcpy(w->qt[0], quant_luma_q75, 64);
+      memcpy(w->qt[1], quant_chroma_q75, 64);
+      break;
+    case 80:
+      memcpy(w->qt[0], quant_luma_q80, 64);
+      memcpy(w->qt[1], quant_chroma_q80, 64);
+      break;
+    case 90:
+      memcpy(w->qt[0], quant_luma_q90, 64);
+      memcpy(w->qt[1], quant_chroma_q90, 64);
+      break;
+    default:
+      scale_quant(w->qt[0], quant_luma_q50, quality);
+      scale_quant(w->qt[1], quant_chroma_q50, quality);
+      break;
+  }
+
+  for (int t = 0; t < 2; t++) {
+    for (int i = 0; i < 64; i++) {
+      uint32_t d = w->qt[t][zigzag[i]] * 8;
+      w->recip[t][i] = (uint16_t)((65536 + d / 2) / d);
+    }
+  }
+}
+
+static void put_dht(jpeg_writer_t *w, uint8_t id, const uint8_t *bits,
+  const uint8_t *vals, int count) {
+  put_byte(w, id);
+  for (int i = 0; i < 16; i++)
+    put_byte(w, bits[i]);
+  for (int i = 0; i < count; i++)
+    put_byte(w, vals[i]);
+}
+
+static void put_headers(jpeg_writer_t *w, uint16_t width, uint16_t height, bool color) {
+  static const uint8_t jfif[] = {
+    0xff, 0xd8, 0xff, 0xe0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+    0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+  };
+  int tables = color ? 2 : 1;
+
+  for (unsigned int i = 0; i < sizeof(jfif); i++)
+    put_byte(w, jfif[i]);
+
+  put_marker(w, 0xdb, 2 + 65 * tables);
+  for (int t = 0; t < tables; t++) {
+    put_byte(w, t);
+    for (int i = 0; i < 64; i++)
+      put_byte(w, w->qt[t][zigzag[i]]);
+  }
+
+  put_marker(w, 0xc0, color ? 17 : 11);
+  put_byte(w, 8);
+  put_byte(w, height >> 8);
+  put_byte(w, height & 0xff);
+  put_byte(w, width >> 8);
+  put_byte(w, width & 0xff);
+  put_byte(w, color ? 3 : 1);
+  put_byte(w, 1);
+  put_byte(w, color ? 0x21 : 0x11);  // Y is 2x1 in 4:2:2
+  put_byte(w, 0);
+  if (color) {
+    for (int c = 2; c <= 3; c++) {
+      put_byte(w, c);
+      put_byte(w, 0x11);
+      put_byte(w, 1);
+    }
+  }
+
+  put_marker(w, 0xc4, 2 + (17 + 12 + 17 + 162) * tables);
+  put_dht(w, 0x00, dc_luma_bits, dc_vals, 12);
+  put_dht(w, 0x10, ac_luma_bits, ac_luma_vals, 162);
+  if (color) {
+    put_dht(w, 0x01, dc_chroma_bits, dc_vals, 12);
+    put_dht(w, 0x11, ac_chroma_bits, ac_chroma_vals, 162);
+  }
+
+  put_marker(w, 0xda, color ? 12 : 8);
+  put_byte(w, color ? 3 : 1);
+  put_byte(w, 1);
+  put_byte(w, 0x00);
+  if (color) {
+    put_byte(w, 2);
+    put_byte(w, 0x11);
+    put_byte(w, 3);
+    put_byte(w, 0x11);
+  }
+  put_byte(w, 0);
+  put_byte(w, 63);
+  put_byte(w, 0);
+}
+
+// Loeffler-Ligtenberg-Moschytz integer DCT as in the IJG jfdctint.c,
+// the output is scaled up by 8
+#define CONST_BITS 13
+#define PASS1_BITS 2
+#define DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+static void fdct(int32_t *data) {
+  int32_t tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+  int32_t tmp10, tmp11, tmp12, tmp13;
+  int32_t z1, z2, z3, z4, z5;
+  int32_t *p;
+
+  for (p = data; p < data + 64; p += 8) {
+    tmp0 = p[0] + p[7];
+    tmp7 = p[0] - p[7];
+    tmp1 = p[1] + p[6];
+    tmp6 = p[1] - p[6];
+    tmp2 = p[2] + p[5];
+    tmp5 = p[2] - p[5];
+    tmp3 = p[3] + p[4];
+    tmp4 = p[3] - p[4];
+
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    p[0] = (tmp10 + tmp11) << PASS1_BITS;
+    p[4] = (tmp10 - tmp11) << PASS1_BITS;
+    z1 = (tmp12 + tmp13) * FIX_0_541196100;
+    p[2] = DESCALE(z1 + tmp13 * FIX_0_765366865, CONST_BITS - PASS1_BITS);
+    p[6] = DESCALE(z1 - tmp12 * FIX_1_847759065, CONST_BITS - PASS1_BITS);
+
+    z1 = tmp4 + tmp7;
+    z2 = tmp5 + tmp6;
+    z3 = tmp4 + tmp6;
+    z4 = tmp5 + tmp7;
+    z5 = (z3 + z4) * FIX_1_175875602;
+    tmp4 *= FIX_0_298631336;
+    tmp5 *= FIX_2_053119869;
+    tmp6 *= FIX_3_072711026;
+    tmp7 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    p[7] = DESCALE(tmp4 + z1 + z3, CONST_BITS - PASS1_BITS);
+    p[5] = DESCALE(tmp5 + z2 + z4, CONST_BITS - PASS1_BITS);
+    p[3] = DESCALE(tmp6 + z2 + z3, CONST_BITS - PASS1_BITS);
+    p[1] = DESCALE(tmp7 + z1 + z4, CONST_BITS - PASS1_BITS);
+  }
+
+  for (p = data; p < data + 8; p++) {
+    tmp0 = p[0] + p[56];
+    tmp7 = p[0] - p[56];
+    tmp1 = p[8] + p[48];
+    tmp6 = p[8] - p[48];
+    tmp2 = p[16] + p[40];
+    tmp5 = p[16] - p[40];
+    tmp3 = p[24] + p[32];
+    tmp4 = p[24] - p[32];
+
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    p[0] = DESCALE(tmp10 + tmp11, PASS1_BITS);
+    p[32] = DESCALE(tmp10 - tmp11, PASS1_BITS);
+    z1 = (tmp12 + tmp13) * FIX_0_541196100;
+    p[16] = DESCALE(z1 + tmp13 * FIX_0_765366865, CONST_BITS + PASS1_BITS);
+    p[48] = DESCALE(z1 - tmp12 * FIX_1_847759065, CONST_BITS + PASS1_BITS);
+
+    z1 = tmp4 + tmp7;
+    z2 = tmp5 + tmp6;
+    z3 = tmp4 + tmp6;
+    z4 = tmp5 + tmp7;
+    z5 = (z3 + z4) * FIX_1_175875602;
+    tmp4 *= FIX_0_298631336;
+    tmp5 *= FIX_2_053119869;
+    tmp6 *= FIX_3_072711026;
+    tmp7 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    p[56] = DESCALE(tmp4 + z1 + z3, CONST_BITS + PASS1_BITS);
+    p[40] = DESCALE(tmp5 + z2 + z4, CONST_BITS + PASS1_BITS);
+    p[24] = DESCALE(tmp6 + z2 + z3, CONST_BITS + PASS1_BITS);
+    p[8] = DESCALE(tmp7 + z1 + z4, CONST_BITS + PASS1_BITS);
+  }
+}
+
+static inline int bit_count(uint32_t v) {
+  return v ? 32 - __builtin_clz(v) : 0;
+}
+
+// block holds level shifted samples in natural order
+static void encode_block(jpeg_writer_t *w, int32_t *block, int comp) {
+  const uint16_t *recip = w->recip[comp ? 1 : 0];
+  const uint32_t *dc_codes = comp ? dc_chroma_codes : dc_luma_codes;
+  const uint32_t *ac_codes = comp ? ac_chroma_codes : ac_luma_codes;
+  int q[64];
+
+  fdct(block);
+  for (int i = 0; i < 64; i++) {
+    int32_t c = block[zigzag[i]];
+    int32_t v = (int32_t)(((uint32_t)(c < 0 ? -c : c) * recip[i] + 32768) >> 16);
+    if (v > 1023 && i)
+      v = 1023;  // largest AC category of the standard tables
+    q[i] = c < 0 ? -v : v;
+  }
+
+  int diff = q[0] - w->dc[comp];
+  w->dc[comp] = q[0];
+  int n = bit_count(diff < 0 ? -diff : diff);
+  put_code(w, dc_codes[n]);
+  if (n)
+    put_bits(w, (diff < 0 ? diff - 1 : diff) & ((1 << n) - 1), n);
+
+  int run = 0;
+  for (int i = 1; i < 64; i++) {
+    int v = q[i];
+    if (!v) {
+      run++;
+      continue;
+    }
+    while (run > 15) {
+      put_code(w, ac_codes[0xf0]);
+      run -= 16;
+    }
+    n = bit_count(v < 0 ? -v : v);
+    put_code(w, ac_codes[(run << 4) | n]);
+    put_bits(w, (v < 0 ? v - 1 : v) & ((1 << n) - 1), n);
+    run = 0;
+  }
+  if (run)
+    put_code(w, ac_codes[0x00]);
+}
+
+static inline void rgb565_to_ycc(const uint8_t *p, int *y, int *cb, int *cr) {
+  int r = p[0] & 0xf8;
+  int g = ((p[0] << 5) | (p[1] >> 3)) & 0xfc;
+  int b = (p[1] << 3) & 0xf8;
+  *y = (77 * r + 150 * g + 29 * b) >> 8;
+  *cb = ((-43 * r - 85 * g + 128 * b) >> 8) + 128;
+  *cr = ((128 * r - 107 * g - 21 * b) >> 8) + 128;
+}
+
+// one 16x8 MCU of a 4:2:2 frame into Y0, Y1, Cb and Cr blocks
+static void load_mcu_422(const uint8_t *src, int format, int width, int height,
+  int mx, int my, int32_t blocks[4][64]) {
+  for (int y = 0; y < 8; y++) {
+    int sy = my + y < height ? my + y : height - 1;
+    const uint8_t *row = src + sy * width * 2;
+    for (int x = 0; x < 16; x += 2) {
+      // pixel pair, clamped to the last whole pair of the row
+      int sx = mx + x < width - 1 ? mx + x : (width - 2) & ~1;
+      const uint8_t *p = row + sx * 2;
+      int y0, y1, cb, cr;
+      if (format == JPEG_YUV422) {
+        y0 = p[0];
+        cb = p[1];
+        y1 = p[2];
+        cr = p[3];
+      } else {
+        int cb1, cr1;
+        rgb565_to_ycc(p, &y0, &cb, &cr);
+        rgb565_to_ycc(p + 2, &y1, &cb1, &cr1);
+        cb = (cb + cb1) >> 1;
+        cr = (cr + cr1) >> 1;
+      }
+      int32_t *yb = blocks[x >> 3] + y * 8 + (x & 7);
+      yb[0] = y0 - 128;
+      yb[1] = y1 - 128;
+      blocks[2][y * 8 + (x >> 1)] = cb - 128;
+      blocks[3][y * 8 + (x >> 1)] = cr - 128;
+    }
+  }
+}
+
+static void load_block_gray(const uint8_t *src, int width, int height,
+  int mx, int my, int32_t *block) {
+  for (int y = 0; y < 8; y++) {
+    int sy = my + y < height ? my + y : height - 1;
+    const uint8_t *row = src + sy * width;
+    for (int x = 0; x < 8; x++) {
+      int sx = mx + x < width ? mx + x : width - 1;
+      block[y * 8 + x] = row[sx] - 128;
+    }
+  }
+}
+
+bool jpeg_encode(const uint8_t *src, uint16_t width, uint16_t height, int format,
+  uint8_t quality, uint8_t *buf, size_t size, jpeg_out_cb cb, void *arg) {
+  jpeg_writer_t w;
+  int32_t blocks[4][64];
+  bool color = format != JPEG_GRAYSCALE;
+
+  if (format != JPEG_GRAYSCALE && format != JPEG_YUV422 && format != JPEG_RGB565)
+    return false;
+  if (!width || !height || size < 256 || (color && width < 2))
+    return false;
+
+  memset(&w, 0, sizeof(w));
+  w.buf = buf;
+  w.size = size;
+  w.cb = cb;
+  w.arg = arg;
+  setup_quant(&w, quality);
+  put_headers(&w, width, height, color);
+
+  for (int my = 0; my < height && !w.failed; my += 8) {
+    if (color) {
+      for (int mx = 0; mx < width; mx += 16) {
+        load_mcu_422(src, format, width, height, mx, my, blocks);
+        encode_block(&w, blocks[0], 0);
+        encode_block(&w, blocks[1], 0);
+        encode_block(&w, blocks[2], 1);
+        encode_block(&w, blocks[3], 2);
+      }
+    } else {
+      for (int mx = 0; mx < width; mx += 8) {
+        load_block_gray(src, width, height, mx, my, blocks[0]);
+        encode_block(&w, blocks[0], 0);
+      }
+    }
+    // hand out every finished row of MCUs
+    flush(&w);
+  }
+
+  if (w.nbits)
+    put_bits(&w, (1 << (8 - w.nbits)) - 1, 8 - w.nbits);  // pad with ones
+  put_byte(&w, 0xff);
+  put_byte(&w, 0xd9);
+  flush(&w);
+  return !w.failed;
+}
+
+bool jpeg_subsample(const uint8_t *src, uint16_t width, uint16_t height, int format,
+  uint8_t scale, uint8_t *out, size_t size, uint16_t *out_width, uint16_t *out_height) {
+  size_t bpp = (format == JPEG_GRAYSCALE) ? 1 : 2;
+
+  if (!scale)
+    return false;
+  size_t w = width / scale;
+  size_t h = height / scale;
+  if (format == JPEG_YUV422)
+    w &= ~((size_t)1);
+  if (w * h * bpp > size)
+    return false;
+
+  for (size_t y = 0; y < h; y++) {
+    const uint8_t *row = src + y * scale * width * bpp;
+    uint8_t *o = out + y * w * bpp;
+    if (format == JPEG_YUV422) {
+      for (size_t x = 0; x < w; x += 2)
+        memcpy(o + x * 2, row + x * scale * 2, 4);
+    } else {
+      for (size_t x = 0; x < w; x++)
+        memcpy(o + x * bpp, row + x * scale * bpp, bpp);
+    }
+  }
+  *out_width = w;
+  *out_height = h;
+  return true;
+}
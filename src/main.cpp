@@ -6,14 +6,30 @@
 #include <SPIFFS.h>
 
 #include "esp_camera.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
 #include "esp_http_server.h"
+#include "esp_heap_caps.h"
 #include "img_converters.h"
+#include "lwip/sockets.h"
+
+#include "config_schema.h"
+#include "duty_cycle.h"
+#include "jpeg_encoder.h"
+#include "rtsp_jpeg.h"
+#include "telemetry_codec.h"
 
 typedef struct {
         httpd_req_t *req;
         size_t len;
 } jpg_chunking_t;
 
+typedef struct {
+        uint8_t *buf;
+        size_t size;
+        size_t len;
+} jpg_buffer_t;
+
 #include "esp_bt.h"
 #include "esp_bt_main.h"
 #include "esp_bt_device.h"
@@ -97,6 +113,9 @@ uint32_t led_current_color;
 String Smyname, Spass, Sssid, Smqttserver, Ssite, Sroom, Smqttuser, Smqttpass;
 unsigned int Imqttport;
 bool Bflipped;
+bool Bdutycycle = false;
+unsigned int Idutyinterval = 300;  // seconds
+unsigned int Idutysnapshot = 0;    // cycles between snapshots, 0 for none
 
 
 // Flags for sensors found
@@ -108,6 +127,8 @@ bool rtc_init_done = false;
 bool rtc_alarm_raised = false;
 bool light_on = true;
 bool camera_found = false;
+uint8_t bme280_address = 0;
+bool duty_running = false;  // inside a duty cycle wake, no reconnect attempts
 
 // Flags for display
 #define DISPLAY_OFF 0
@@ -127,6 +148,26 @@ unsigned long last_display = 0;
 
 // forward declarations
 boolean setup_wifi();
+void log_pools();
+void publish_pools();
+void ws_push_telemetry(const char *topic, const char *value);
+void log_websocket();
+void publish_websocket();
+void log_outbox();
+void publish_outbox();
+void command_telemetry(String *in, unsigned int wordcounter);
+void command_loop(String *in, unsigned int wordcounter);
+void log_rtsp();
+void publish_rtsp();
+void command_rendition(String *in, unsigned int wordcounter);
+void log_http();
+void publish_http();
+void command_encoder(String *in, unsigned int wordcounter);
+void command_clip(String *in, unsigned int wordcounter);
+void command_power(String *in, unsigned int wordcounter);
+void command_soak(String *in, unsigned int wordcounter);
+void command_config(String *in, unsigned int wordcounter);
+bool read_bme280(float *values);
 
 // LED routines
 void setled(byte r, byte g, byte b) {
@@ -163,56 +204,6 @@ void setled(byte show) {
   led.show();
 }
 
-// Debug functions
-void log_config () {
-
-  Log.verbose("Smyname = %s",Smyname.c_str());
-  Log.verbose("Ssite = %s",Ssite.c_str());
-  Log.verbose("Sroom = %s",Sroom.c_str());
-  Log.verbose("Sssid = %s",Sssid.c_str());
-  Log.verbose("Spass = %s",Spass.c_str());
-  Log.verbose("Smqttuser = %s",Smqttuser.c_str());
-  Log.verbose("Smqttpass = %s",Smqttpass.c_str());
-  Log.verbose("Imqttport = %d",Imqttport);
-  Log.verbose(F("Bflipped = %t"),Bflipped);
-
-}
-
-void write_config () {
-  StaticJsonBuffer<512> jsonBuffer;
-  JsonObject& root = jsonBuffer.createObject();
-  root["myname"] = Smyname;
-  root["flipped"] = Bflipped;
-  JsonObject& network = root.createNestedObject("network");
-  network["pass"] = Spass;
-  network["ssid"] = Sssid;
-  JsonObject& mqtt = root.createNestedObject("mqtt");
-  mqtt["server"] = Smqttserver;
-  mqtt["user"] = Smqttuser;
-  mqtt["pass"] = Smqttpass;
-  mqtt["port"] = Imqttport;
-  JsonObject& location = root.createNestedObject("location");
-  location["site"] = Ssite;
-  location["room"] = Sroom;
-
-  Log.notice(F("Writing new config file"));
-  root.prettyPrintTo(Serial);
-
-  SPIFFS.begin();
-  File f = SPIFFS.open("/config.json","w");
-  if (!f) {
-    Log.error(F("Open of config file for writing failed"));
-  } else {
-    if (root.printTo(f) == 0) {
-      Log.error(F("Writing object into file failed"));
-    } else {
-      Log.notice(F("Written new config. Now reboot"));
-    }
-    f.close();
-  }
-SPIFFS.end();
-}
-
 // Logging helper routines
 void printTimestamp(Print* _logOutput) {
   char c[12];
@@ -255,32 +246,60 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length)  {
   }
 
   if (in[0] == F("config")) {
-    if (wordcounter == 0) {
-      log_config();
-    }
-    if (wordcounter == 1) {
-      if (in[1] == F("write")) {
-        log_config();
-        write_config();
-      }
-    }
-    if (wordcounter == 2) {
-      if (in[1] == F("room")) {
-        Sroom = in[2];
-      }
-      if (in[1] == F("site")) {
-        Ssite = in[2];
-      }
-      if (in[1] == F("myname")) {
-        Smyname = in[2];
-      }
-      if (in[1] == F("mqttuser")) {
-        Smqttuser = in[2];
-      }
-      if (in[1] == F("mqttpass")) {
-        Smqttpass = in[2];
-      }
-    }
+    command_config(in, wordcounter);
+  }
+
+  if (in[0] == F("loop")) {
+    command_loop(in, wordcounter);
+  }
+
+  if (in[0] == F("telemetry")) {
+    command_telemetry(in, wordcounter);
+  }
+
+  if (in[0] == F("outbox")) {
+    log_outbox();
+    publish_outbox();
+  }
+
+  if (in[0] == F("clip")) {
+    command_clip(in, wordcounter);
+  }
+
+  if (in[0] == F("power")) {
+    command_power(in, wordcounter);
+  }
+
+  if (in[0] == F("soak")) {
+    command_soak(in, wordcounter);
+  }
+
+  if (in[0] == F("encoder")) {
+    command_encoder(in, wordcounter);
+  }
+
+  if (in[0] == F("http")) {
+    log_http();
+    publish_http();
+  }
+
+  if (in[0] == F("rendition")) {
+    command_rendition(in, wordcounter);
+  }
+
+  if (in[0] == F("rtsp")) {
+    log_rtsp();
+    publish_rtsp();
+  }
+
+  if (in[0] == F("ws")) {
+    log_websocket();
+    publish_websocket();
+  }
+
+  if (in[0] == F("pool")) {
+    log_pools();
+    publish_pools();
   }
 
   if (in[0] == "display" && wordcounter >= 1) {
@@ -362,9 +381,266 @@ boolean mqtt_reconnect() {
 }
 
 
+// Store-and-forward outbox
+//
+// Messages that cannot be published right now are queued with a sequence
+// number and timestamp. When the RAM queue is full it is spilled to SPIFFS.
+// Once the broker is back, loop_outbox() replays the spill file first and
+// then the RAM queue in rate limited batches. Replayed messages go to
+// <topic>/replay as "seq age value", age in seconds or -1 if the message
+// is from before the last reboot. The last replayed sequence number is kept
+// on SPIFFS, so nothing is sent twice after a reboot during replay.
+// Sequence numbers are reserved on SPIFFS in blocks, so they never repeat
+// across reboots and consumers can de-duplicate on them.
+#define OUTBOX_LEN 32
+#define OUTBOX_TOPIC_LEN 24
+#define OUTBOX_MSG_LEN 32
+#define OUTBOX_FILE "/outbox.bin"
+#define OUTBOX_SEQ_FILE "/outbox.seq"
+#define OUTBOX_FILE_MAX 2000    // entries, about 140 kB
+#define OUTBOX_BATCH 10         // messages per batch
+#define OUTBOX_BATCH_DELAY 500  // ms between batches
+#define OUTBOX_SEQ_BLOCK 64     // sequence numbers reserved per write
+
+typedef struct {
+  uint32_t seq;
+  uint32_t timestamp;
+  uint8_t len;
+  char topic[OUTBOX_TOPIC_LEN];
+  uint8_t msg[OUTBOX_MSG_LEN];
+} outbox_entry_t;
+
+outbox_entry_t outbox[OUTBOX_LEN];
+unsigned int outbox_head = 0;
+unsigned int outbox_len = 0;
+uint32_t outbox_seq = 0;          // last sequence number handed out
+uint32_t outbox_sent_seq = 0;     // last sequence number replayed
+uint32_t outbox_seq_reserved = 0; // highest sequence number on SPIFFS
+uint32_t outbox_boot_seq = 1;     // first sequence number of this boot
+uint32_t outbox_file_entries = 0;
+uint32_t outbox_file_pos = 0;     // spill file entries already replayed
+unsigned long outbox_last_batch = 0;
+unsigned long outbox_replay_start = 0;
+
+// statistics
+uint32_t outbox_spilled = 0;
+uint32_t outbox_dropped = 0;
+uint32_t outbox_replayed = 0;
+uint32_t outbox_duplicates = 0;
+uint32_t outbox_replay_rate = 0;  // messages per second of the last replay
+
+unsigned int outbox_pending() {
+  return outbox_len + (outbox_file_entries - outbox_file_pos);
+}
+
+static void outbox_save_seq() {
+  SPIFFS.begin();
+  File f = SPIFFS.open(OUTBOX_SEQ_FILE, "w");
+  if (f) {
+    f.write((const uint8_t *)&outbox_sent_seq, sizeof(outbox_sent_seq));
+    f.write((const uint8_t *)&outbox_seq_reserved, sizeof(outbox_seq_reserved));
+    f.close();
+  }
+}
+
+// move the whole RAM queue to the end of the spill file
+static bool outbox_spill() {
+  if (outbox_file_entries + outbox_len > OUTBOX_FILE_MAX)
+    return false;
+
+  SPIFFS.begin();
+  File f = SPIFFS.open(OUTBOX_FILE, "a");
+  if (!f) {
+    Log.error(F("Cannot open outbox file"));
+    return false;
+  }
+  while (outbox_len) {
+    if (f.write((const uint8_t *)&outbox[outbox_head], sizeof(outbox_entry_t))
+        != sizeof(outbox_entry_t)) {
+      Log.error(F("Writing outbox file failed"));
+      f.close();
+      return false;
+    }
+    outbox_head = (outbox_head + 1) % OUTBOX_LEN;
+    outbox_len--;
+    outbox_file_entries++;
+    outbox_spilled++;
+  }
+  f.close();
+  outbox_save_seq();
+  return true;
+}
+
+void outbox_push(const char *topic, const uint8_t *msg, size_t len) {
+  if (len > OUTBOX_MSG_LEN) {
+    Log.error(F("Outbox message for %s too long"), topic);
+    outbox_dropped++;
+    return;
+  }
+  if (outbox_len == OUTBOX_LEN && !outbox_spill()) {
+    // no room left anywhere, lose the oldest message in RAM
+    outbox_head = (outbox_head + 1) % OUTBOX_LEN;
+    outbox_len--;
+    outbox_dropped++;
+  }
+
+  outbox_entry_t *e = &outbox[(outbox_head + outbox_len) % OUTBOX_LEN];
+  e->seq = ++outbox_seq;
+  if (outbox_seq > outbox_seq_reserved) {
+    outbox_seq_reserved = outbox_seq + OUTBOX_SEQ_BLOCK;
+    outbox_save_seq();
+  }
+  e->timestamp = millis();
+  e->len = len;
+  strncpy(e->topic, topic, OUTBOX_TOPIC_LEN - 1);
+  e->topic[OUTBOX_TOPIC_LEN - 1] = 0;
+  memcpy(e->msg, msg, len);
+  outbox_len++;
+}
+
+static bool outbox_publish(outbox_entry_t *e) {
+  char mytopic[60];
+  char payload[OUTBOX_MSG_LEN + 24];
+  long age = -1;
+
+  if (e->seq >= outbox_boot_seq)
+    age = (millis() - e->timestamp) / 1000;
+  snprintf(mytopic, 60, "/%s/%s/%s/replay", Ssite.c_str(), Sroom.c_str(), e->topic);
+  int n = snprintf(payload, sizeof(payload), "%lu %ld ", (unsigned long)e->seq, age);
+  memcpy(payload + n, e->msg, e->len);
+  return client.publish(mytopic, (const uint8_t *)payload, n + e->len);
+}
+
+// replay one batch of queued messages, false if the broker refused one
+static bool outbox_send_batch() {
+  bool ok = true;
+
+  if (!outbox_replay_start)
+    outbox_replay_start = millis();
+
+  File f;
+  bool from_file = outbox_file_pos < outbox_file_entries;
+  if (from_file) {
+    SPIFFS.begin();
+    f = SPIFFS.open(OUTBOX_FILE, "r");
+    if (!f || !f.seek(outbox_file_pos * sizeof(outbox_entry_t))) {
+      Log.error(F("Cannot read outbox file, %d messages lost"),
+        outbox_file_entries - outbox_file_pos);
+      outbox_dropped += outbox_file_entries - outbox_file_pos;
+      outbox_file_pos = outbox_file_entries;
+    }
+  }
+
+  outbox_entry_t e;
+  uint32_t sent = outbox_sent_seq;
+  for (unsigned int n = 0; n < OUTBOX_BATCH; n++) {
+    bool file_entry = outbox_file_pos < outbox_file_entries;
+    if (file_entry) {
+      if (f.read((uint8_t *)&e, sizeof(e)) != sizeof(e)) {
+        Log.error(F("Outbox file truncated"));
+        outbox_dropped += outbox_file_entries - outbox_file_pos;
+        outbox_file_pos = outbox_file_entries;
+        continue;
+      }
+    } else if (outbox_len) {
+      e = outbox[outbox_head];
+    } else {
+      break;
+    }
+
+    if (e.seq <= outbox_sent_seq) {
+      outbox_duplicates++;
+    } else if (outbox_publish(&e)) {
+      outbox_sent_seq = e.seq;
+      outbox_replayed++;
+    } else {
+      // try again with the next batch
+      ok = false;
+      break;
+    }
+
+    if (file_entry) {
+      outbox_file_pos++;
+    } else {
+      outbox_head = (outbox_head + 1) % OUTBOX_LEN;
+      outbox_len--;
+    }
+  }
+
+  if (f)
+    f.close();
+  if (from_file && outbox_file_pos == outbox_file_entries) {
+    SPIFFS.remove(OUTBOX_FILE);
+    outbox_file_entries = outbox_file_pos = 0;
+  }
+  if (outbox_sent_seq != sent)
+    outbox_save_seq();
+
+  if (!outbox_pending()) {
+    unsigned long duration = millis() - outbox_replay_start;
+    outbox_replay_rate = outbox_replayed * 1000 / (duration ? duration : 1);
+    Log.notice(F("Outbox replayed after %d ms, %d msg/s"), duration, outbox_replay_rate);
+    outbox_replay_start = 0;
+    outbox_replayed = 0;
+  }
+  return ok;
+}
+
+void loop_outbox() {
+  if (!outbox_pending() || !client.connected())
+    return;
+  if (millis() - outbox_last_batch < OUTBOX_BATCH_DELAY)
+    return;
+  outbox_last_batch = millis();
+  outbox_send_batch();
+}
+
+// pick up messages spilled before the last reboot
+void setup_outbox() {
+  SPIFFS.begin();
+  File f = SPIFFS.open(OUTBOX_SEQ_FILE, "r");
+  if (f) {
+    f.read((uint8_t *)&outbox_sent_seq, sizeof(outbox_sent_seq));
+    f.read((uint8_t *)&outbox_seq_reserved, sizeof(outbox_seq_reserved));
+    f.close();
+  }
+  // numbers up to the reservation may have been handed out before the reboot
+  outbox_seq = outbox_seq_reserved > outbox_sent_seq ? outbox_seq_reserved : outbox_sent_seq;
+
+  f = SPIFFS.open(OUTBOX_FILE, "r");
+  if (f) {
+    outbox_entry_t e;
+    outbox_file_entries = f.size() / sizeof(outbox_entry_t);
+    if (outbox_file_entries &&
+        f.seek((outbox_file_entries - 1) * sizeof(outbox_entry_t)) &&
+        f.read((uint8_t *)&e, sizeof(e)) == sizeof(e) && e.seq > outbox_seq)
+      outbox_seq = e.seq;
+    f.close();
+    Log.notice(F("Outbox: %d messages waiting on SPIFFS"), outbox_file_entries);
+  }
+  outbox_boot_seq = outbox_seq + 1;
+}
+
+void log_outbox() {
+  Log.notice(F("Outbox: %d queued (%d on SPIFFS), %d spilled, %d dropped, %d duplicates"),
+    outbox_pending(), outbox_file_entries - outbox_file_pos, outbox_spilled,
+    outbox_dropped, outbox_duplicates);
+}
+
 unsigned long lastReconnectAttempt = 0;
+void mqtt_publish(char *topic, const uint8_t *msg, size_t len) {
+  // keep the order, nothing goes out directly while older messages wait
+  if (client.connected() && !outbox_pending()) {
+    char mytopic[50];
+    snprintf(mytopic, 50, "/%s/%s/%s", Ssite.c_str(), Sroom.c_str(),topic);
+    if (client.publish(mytopic, msg, len))
+      return;
+  }
+  outbox_push(topic, msg, len);
+}
+
 void mqtt_publish(char *topic, char *msg) {
-  if (!client.connected()) {
+  if (!client.connected() && !duty_running) {
     long now = millis();
     if (now - lastReconnectAttempt > 5000) {
       lastReconnectAttempt = now;
@@ -376,10 +652,7 @@ void mqtt_publish(char *topic, char *msg) {
   client.loop();
 
   Log.verbose("MQTT Publish message [%s]:%s",topic,msg);
-
-  char mytopic[50];
-  snprintf(mytopic, 50, "/%s/%s/%s", Ssite.c_str(), Sroom.c_str(),topic);
-  client.publish(mytopic, msg);
+  mqtt_publish(topic, (const uint8_t *)msg, strlen(msg));
 }
 
 void mqtt_publish(char *topic, int i) {
@@ -400,6 +673,257 @@ void mqtt_publish(char *topic, float value) {
   mqtt_publish(topic, buf);
 }
 
+// Sensor telemetry
+//
+// Readings go out as text, one topic per value, and/or as one compact
+// binary packet on the telemetry topic (see telemetry_codec.h).
+#define TELEMETRY_TEXT 1
+#define TELEMETRY_BINARY 2
+
+#define CHANNEL_TEMPERATURE 0
+#define CHANNEL_AIRPRESSURE 1
+#define CHANNEL_HUMIDITY 2
+#define CHANNEL_COUNT 3
+
+telemetry_channel_t telemetry_channels[CHANNEL_COUNT] = {
+  { "temperature", 100, true },  // 0.01 C
+  { "airpressure", 10, true },   // 0.1 hPa
+  { "humidity", 10, true },      // 0.1 %
+};
+telemetry_state_t telemetry;
+unsigned int telemetry_mode = TELEMETRY_TEXT;
+unsigned int telemetry_keyframe = 10;
+
+// statistics
+uint32_t telemetry_readings = 0;
+uint32_t telemetry_text_bytes = 0;
+uint32_t telemetry_binary_bytes = 0;
+uint32_t telemetry_packets = 0;
+uint32_t telemetry_encode_us = 0;
+
+void setup_telemetry() {
+  telemetry_init(&telemetry, telemetry_channels, CHANNEL_COUNT, telemetry_keyframe);
+}
+
+void publish_telemetry(const float *values, uint8_t mask) {
+  char buf[TELEMETRY_MAX_PACKET];
+  // topic prefix "/site/room/" as sent on the wire
+  size_t prefix = Ssite.length() + Sroom.length() + 3;
+
+  for (unsigned int i = 0; i < CHANNEL_COUNT; i++) {
+    if (!(mask & (1 << i)))
+      continue;
+    telemetry_readings++;
+    snprintf(buf, 14, "%.3f", values[i]);
+    // WebSocket subscribers get the sensor channels only, whatever the mode
+    ws_push_telemetry(telemetry_channels[i].name, buf);
+    if (telemetry_mode & TELEMETRY_TEXT) {
+      mqtt_publish((char *)telemetry_channels[i].name, values[i]);
+      telemetry_text_bytes += prefix + strlen(telemetry_channels[i].name) + strlen(buf);
+    }
+  }
+
+  if (telemetry_mode & TELEMETRY_BINARY) {
+    unsigned long start = micros();
+    size_t len = telemetry_encode(&telemetry, values, mask, (uint8_t *)buf, sizeof(buf));
+    telemetry_encode_us += micros() - start;
+    if (len) {
+      telemetry_packets++;
+      telemetry_binary_bytes += prefix + strlen("telemetry") + len;
+      mqtt_publish("telemetry", (const uint8_t *)buf, len);
+    } else {
+      Log.error(F("Telemetry encoding failed"));
+    }
+  }
+}
+
+void log_telemetry() {
+  Log.notice(F("Telemetry mode %d, schema %X, %d readings, %d packets"),
+    telemetry_mode, telemetry.schema, telemetry_readings, telemetry_packets);
+  for (unsigned int i = 0; i < CHANNEL_COUNT; i++) {
+    Log.notice(F("Channel %s: scale %F, delta %T"), telemetry_channels[i].name,
+      telemetry_channels[i].scale, telemetry_channels[i].delta);
+  }
+  if (telemetry_readings && (telemetry_mode & TELEMETRY_TEXT))
+    Log.notice(F("Text: %F B/reading"), (float)telemetry_text_bytes / telemetry_readings);
+  if (telemetry_readings && (telemetry_mode & TELEMETRY_BINARY))
+    Log.notice(F("Binary: %F B/reading"), (float)telemetry_binary_bytes / telemetry_readings);
+  if (telemetry_packets)
+    Log.notice(F("Encode: %d us/packet"), telemetry_encode_us / telemetry_packets);
+}
+
+// telemetry text|binary|both
+// telemetry <channel> scale <n>
+// telemetry <channel> delta on|off
+void command_telemetry(String *in, unsigned int wordcounter) {
+  if (wordcounter == 0) {
+    log_telemetry();
+    return;
+  }
+  if (wordcounter == 1) {
+    if (in[1] == F("text"))
+      telemetry_mode = TELEMETRY_TEXT;
+    else if (in[1] == F("binary"))
+      telemetry_mode = TELEMETRY_BINARY;
+    else if (in[1] == F("both"))
+      telemetry_mode = TELEMETRY_TEXT | TELEMETRY_BINARY;
+    telemetry_reset(&telemetry);
+    return;
+  }
+  if (wordcounter == 3) {
+    for (unsigned int i = 0; i < CHANNEL_COUNT; i++) {
+      if (in[1] != telemetry_channels[i].name)
+        continue;
+      if (in[2] == F("scale") && in[3].toFloat() > 0)
+        telemetry_channels[i].scale = in[3].toFloat();
+      if (in[2] == F("delta"))
+        telemetry_channels[i].delta = (in[3] == F("on"));
+      // packets carry the new schema, decoders with the old settings
+      // refuse them until they are given the same channel table
+      telemetry_reset(&telemetry);
+      Log.notice(F("Telemetry schema now %X"), telemetry.schema);
+    }
+  }
+}
+
+// Main loop profiler
+//
+// loop() calls profile_mark() after each of its sections. Every section
+// gets a histogram of its run times in power of two microsecond buckets.
+// An iteration over loop_budget ms is a stall: it is kept in a small ring
+// with the section that took longest and reported on the loop/stall topic.
+// Costs two micros() calls and a few adds per section.
+#define SECTION_RECONNECT 0
+#define SECTION_MQTT 1
+#define SECTION_OUTBOX 2
+#define SECTION_SENSORS 3
+#define SECTION_WEBSOCKET 4
+#define SECTION_DISPLAY 5
+#define SECTION_RTSP 6
+#define SECTION_CLIP 7
+#define SECTION_SOAK 8
+#define SECTION_REPORT 9
+#define SECTION_COUNT 10
+#define PROFILE_BUCKETS 16   // 1 us ... 32 s
+#define PROFILE_STALLS 8
+#define PROFILE_REPORT_DELAY 10000 // ms between stall reports
+
+const char *section_names[SECTION_COUNT] = {
+  "reconnect", "mqtt", "outbox", "sensors", "websocket", "display", "rtsp",
+  "clip", "soak", "report"
+};
+
+typedef struct {
+  unsigned long when;      // millis() at end of the iteration
+  uint32_t total_us;
+  uint8_t section;         // slowest section
+  uint32_t section_us;
+} loop_stall_t;
+
+uint32_t profile_histogram[SECTION_COUNT][PROFILE_BUCKETS];
+uint32_t profile_max_us[SECTION_COUNT];
+uint32_t profile_iteration_us[SECTION_COUNT];
+loop_stall_t profile_stalls[PROFILE_STALLS];
+uint32_t profile_stall_count = 0;
+uint32_t profile_iterations = 0;
+unsigned long profile_start = 0;
+unsigned long profile_last = 0;
+unsigned long profile_last_report = 0;
+bool profile_reported = true;
+unsigned int loop_budget = 100; // ms
+
+static unsigned int profile_bucket(uint32_t us) {
+  unsigned int b = us ? 32 - __builtin_clz(us) : 0;
+  return b < PROFILE_BUCKETS ? b : PROFILE_BUCKETS - 1;
+}
+
+void profile_begin() {
+  profile_start = profile_last = micros();
+}
+
+void profile_mark(unsigned int section) {
+  unsigned long t = micros();
+  uint32_t us = t - profile_last;
+
+  profile_last = t;
+  profile_iteration_us[section] = us;
+  profile_histogram[section][profile_bucket(us)]++;
+  if (us > profile_max_us[section])
+    profile_max_us[section] = us;
+}
+
+void profile_end() {
+  uint32_t total = profile_last - profile_start;
+
+  profile_iterations++;
+  if (total > loop_budget * 1000UL) {
+    loop_stall_t *st = &profile_stalls[profile_stall_count % PROFILE_STALLS];
+    st->when = millis();
+    st->total_us = total;
+    st->section = 0;
+    for (unsigned int i = 1; i < SECTION_COUNT; i++) {
+      if (profile_iteration_us[i] > profile_iteration_us[st->section])
+        st->section = i;
+    }
+    st->section_us = profile_iteration_us[st->section];
+    profile_stall_count++;
+    profile_reported = false;
+    Log.warning(F("Loop stall: %d ms, %s took %d ms"), total / 1000,
+      section_names[st->section], st->section_us / 1000);
+  }
+}
+
+// publishing may reconnect and block as well, so this runs as a profiled
+// section of its own and only now and then
+void profile_report() {
+  if (!profile_reported && millis() - profile_last_report > PROFILE_REPORT_DELAY) {
+    loop_stall_t *st = &profile_stalls[(profile_stall_count - 1) % PROFILE_STALLS];
+    char msg[40];
+    snprintf(msg, 40, "%s %lu %lu", section_names[st->section],
+      (unsigned long)(st->section_us / 1000), (unsigned long)(st->total_us / 1000));
+    profile_reported = true;
+    profile_last_report = millis();
+    mqtt_publish("loop/stall", msg);
+  }
+}
+
+void profile_reset() {
+  memset(profile_histogram, 0, sizeof(profile_histogram));
+  memset(profile_max_us, 0, sizeof(profile_max_us));
+  profile_stall_count = 0;
+  profile_iterations = 0;
+  profile_reported = true;
+}
+
+void log_profile() {
+  Log.notice(F("Loop: %d iterations, %d stalls over %d ms"),
+    profile_iterations, profile_stall_count, loop_budget);
+  for (unsigned int i = 0; i < SECTION_COUNT; i++) {
+    Log.notice(F("Section %s: max %d us"), section_names[i], profile_max_us[i]);
+  }
+}
+
+// loop [reset|budget <ms>]
+void command_loop(String *in, unsigned int wordcounter) {
+  if (wordcounter == 0) {
+    log_profile();
+    mqtt_publish("loop/stalls", profile_stall_count);
+    mqtt_publish("loop/iterations", profile_iterations);
+  } else if (in[1] == F("reset")) {
+    profile_reset();
+  } else if (in[1] == F("budget") && wordcounter == 2 && in[2].toInt() > 0) {
+    loop_budget = in[2].toInt();
+  }
+}
+
+void publish_outbox() {
+  mqtt_publish("outbox/depth", (uint32_t)outbox_pending());
+  mqtt_publish("outbox/spilled", outbox_spilled);
+  mqtt_publish("outbox/dropped", outbox_dropped);
+  mqtt_publish("outbox/duplicates", outbox_duplicates);
+  mqtt_publish("outbox/rate", outbox_replay_rate);
+}
+
 
 
 
@@ -463,6 +987,8 @@ void setup_i2c() {
       if (address == 0x76 || address == 0x77) {
         // BME280
         bme280_found = bme280.begin(address);
+        if (bme280_found)
+          bme280_address = address;
         Log.notice("BME280 found? %T at 0x%x",bme280_found,address);
       }
     }
@@ -487,6 +1013,168 @@ void setup_led() {
   led.show();
 }
 
+// Buffer pool
+//
+// Fixed size slabs for frames, encode output and analysis scratch space.
+// Every pool is one allocation made at boot, so frame processing never
+// touches the heap and cannot fragment it over long uptimes.
+// Slabs are handed out lock-free through an atomic free bitmask.
+#define POOL_FRAME 0    // copies of camera frames, large and streamed: PSRAM
+#define POOL_ENCODE 1   // JPEG encode output, large and streamed: PSRAM
+#define POOL_SCRATCH 2  // analysis scratch, small and random access: internal
+#define POOL_COUNT 3
+#define POOL_MAX_SLABS 32
+
+typedef struct {
+  const char *name;
+  size_t slab_size;
+  uint8_t slabs;
+  bool prefer_psram;
+  uint8_t *base;
+  bool in_psram;
+  volatile uint32_t free_mask;
+  volatile uint32_t in_use;
+  volatile uint32_t high_water;
+  volatile uint32_t failures;
+} buffer_pool_t;
+
+buffer_pool_t pools[POOL_COUNT] = {
+  { "frame",   0, 0, true,  NULL, false, 0, 0, 0, 0 },
+  { "encode",  0, 0, true,  NULL, false, 0, 0, 0, 0 },
+  { "scratch", 0, 0, false, NULL, false, 0, 0, 0, 0 },
+};
+
+static uint8_t *pool_alloc(size_t size, bool psram, bool *in_psram) {
+  uint8_t *p = NULL;
+  if (psram && psramFound()) {
+    p = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (p) {
+      *in_psram = true;
+      return p;
+    }
+  }
+  *in_psram = false;
+  return (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+void setup_pool(unsigned int pool, size_t slab_size, uint8_t slabs) {
+  buffer_pool_t *p = &pools[pool];
+
+  if (slabs > POOL_MAX_SLABS)
+    slabs = POOL_MAX_SLABS;
+  // round up so every slab stays 4 byte aligned
+  slab_size = (slab_size + 3) & ~((size_t)3);
+
+  // shrink the pool rather than fail completely
+  while (slabs > 0) {
+    p->base = pool_alloc(slab_size * slabs, p->prefer_psram, &p->in_psram);
+    if (p->base)
+      break;
+    slabs--;
+  }
+  p->slab_size = slab_size;
+  p->slabs = slabs;
+  p->free_mask = (slabs == 32) ? 0xffffffff : ((1UL << slabs) - 1);
+  Log.notice(F("Pool %s: %d x %d B in %s"), p->name, slabs, slab_size,
+    p->in_psram ? "PSRAM" : "internal RAM");
+}
+
+uint8_t *pool_get(unsigned int pool) {
+  buffer_pool_t *p = &pools[pool];
+  uint32_t mask = __atomic_load_n(&p->free_mask, __ATOMIC_ACQUIRE);
+
+  while (mask) {
+    uint32_t bit = mask & (~mask + 1);
+    if (__atomic_compare_exchange_n(&p->free_mask, &mask, mask & ~bit,
+          false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      uint32_t used = __atomic_add_fetch(&p->in_use, 1, __ATOMIC_RELAXED);
+      uint32_t hw = __atomic_load_n(&p->high_water, __ATOMIC_RELAXED);
+      while (used > hw &&
+             !__atomic_compare_exchange_n(&p->high_water, &hw, used,
+               false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+      return p->base + p->slab_size * __builtin_ctz(bit);
+    }
+    // mask has been reloaded by the failed exchange, try again
+  }
+  __atomic_add_fetch(&p->failures, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+void pool_put(unsigned int pool, uint8_t *buf) {
+  buffer_pool_t *p = &pools[pool];
+
+  if (!buf)
+    return;
+  if (!p->base || buf < p->base || buf >= p->base + p->slab_size * p->slabs ||
+      (buf - p->base) % p->slab_size) {
+    Log.error(F("Pool %s: foreign buffer returned"), p->name);
+    return;
+  }
+  uint32_t bit = 1UL << ((buf - p->base) / p->slab_size);
+  // a second put would hand the slab out twice and underflow in_use
+  if (__atomic_fetch_or(&p->free_mask, bit, __ATOMIC_RELEASE) & bit) {
+    Log.error(F("Pool %s: buffer returned twice"), p->name);
+    return;
+  }
+  __atomic_sub_fetch(&p->in_use, 1, __ATOMIC_RELAXED);
+}
+
+size_t pool_slab_size(unsigned int pool) {
+  return pools[pool].slab_size;
+}
+
+void setup_pools() {
+  if (psramFound()) {
+    setup_pool(POOL_FRAME, 64 * 1024, 6);
+    setup_pool(POOL_ENCODE, 64 * 1024, 8);
+    setup_pool(POOL_SCRATCH, 8 * 1024, 4);
+  } else {
+    setup_pool(POOL_FRAME, 16 * 1024, 1);
+    setup_pool(POOL_ENCODE, 16 * 1024, 1);
+    setup_pool(POOL_SCRATCH, 4 * 1024, 1);
+  }
+}
+
+// fragmentation: 100 means no free block is as large as the free space
+int heap_fragmentation(uint32_t caps) {
+  size_t free_size = heap_caps_get_free_size(caps);
+  if (free_size == 0)
+    return 0;
+  return 100 - (int)(heap_caps_get_largest_free_block(caps) * 100 / free_size);
+}
+
+void log_pools() {
+  for (unsigned int i = 0; i < POOL_COUNT; i++) {
+    buffer_pool_t *p = &pools[i];
+    Log.notice(F("Pool %s: %d/%d used, high water %d, failures %d"),
+      p->name, p->in_use, p->slabs, p->high_water, p->failures);
+  }
+  Log.notice(F("Heap internal: %d B free, %d%% fragmented"),
+    heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+    heap_fragmentation(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+  if (psramFound()) {
+    Log.notice(F("Heap PSRAM: %d B free, %d%% fragmented"),
+      heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+      heap_fragmentation(MALLOC_CAP_SPIRAM));
+  }
+}
+
+void publish_pools() {
+  char topic[32];
+  for (unsigned int i = 0; i < POOL_COUNT; i++) {
+    snprintf(topic, 32, "pool/%s/inuse", pools[i].name);
+    mqtt_publish(topic, (uint32_t)pools[i].in_use);
+    snprintf(topic, 32, "pool/%s/highwater", pools[i].name);
+    mqtt_publish(topic, (uint32_t)pools[i].high_water);
+    snprintf(topic, 32, "pool/%s/failures", pools[i].name);
+    mqtt_publish(topic, (uint32_t)pools[i].failures);
+  }
+  mqtt_publish("heap/free", (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+  mqtt_publish("heap/fragmentation", heap_fragmentation(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+}
+
+
 // Camera routinges
 void setup_camera() {
   camera_config_t config;
@@ -512,9 +1200,16 @@ void setup_camera() {
   // config.pixel_format = PIXFORMAT_JPEG;
   config.pixel_format = PIXFORMAT_JPEG;
   //init with high specs to pre-allocate larger buffers
-  config.frame_size = FRAMESIZE_QQVGA;
+  // with PSRAM the driver places its frame buffers there, so we can afford
+  // a larger frame and one more buffer
+  if (psramFound()) {
+    config.frame_size = FRAMESIZE_SVGA;
+    config.fb_count = 3;
+  } else {
+    config.frame_size = FRAMESIZE_QQVGA;
+    config.fb_count = 2;
+  }
   config.jpeg_quality = 10;
-  config.fb_count = 2;
 
   // camera init
   esp_err_t err = esp_camera_init(&config);
@@ -530,39 +1225,6 @@ void setup_camera() {
 
 }
 
-// read the config file and parse its data
-void setup_readconfig() {
-  SPIFFS.begin();
-  File f = SPIFFS.open("/config.json","r");
-  if (!f) {
-    Log.error("Cannot open config file");
-    return;
-  }
-  StaticJsonBuffer<512> jsonBuffer;
-
- // Parse the root object
- JsonObject &root = jsonBuffer.parseObject(f);
-
- if (!root.success())
-   Log.error("Failed to read file");
-
- // Copy values from the JsonObject to the Config
-   Smyname = root["myname"].as<String>();
-   Bflipped = root["flipped"];
-   Spass = root["network"]["pass"].as<String>();
-   Sssid = root["network"]["ssid"].as<String>();
-   Smqttserver = root["mqtt"]["server"].as<String>();
-   Ssite = root["location"]["site"].as<String>();
-   Sroom = root["location"]["room"].as<String>();
-   Smqttuser = root["mqtt"]["user"].as<String>();
-   Smqttpass = root["mqtt"]["pass"].as<String>();
-   Imqttport = root["mqtt"]["port"];
-
-
-  f.close();
-  SPIFFS.end();
-}
-
 boolean setup_wifi() {
   WiFi.persistent(false);
   WiFi.disconnect();
@@ -586,9 +1248,13 @@ boolean setup_wifi() {
   return true;
 }
 
+// PubSubClient keeps the pointer, Smqttserver moves when the config changes
+char mqtt_host[CONFIG_STRING_MAX + 1];
+
 void setup_mqtt() {
   client.setClient(espClient);
-  client.setServer(Smqttserver.c_str(), Imqttport);
+  strncpy(mqtt_host, Smqttserver.c_str(), sizeof(mqtt_host) - 1);
+  client.setServer(mqtt_host, Imqttport);
   client.setCallback(mqtt_callback);
 
 }
@@ -779,39 +1445,2208 @@ static size_t jpg_encode_stream(void * arg, size_t index, const void* data, size
 }
 
 
-static esp_err_t index_handler(httpd_req_t *req){
-    camera_fb_t * fb = NULL;
-    esp_err_t res = ESP_OK;
-
-    fb = esp_camera_fb_get();
-    if (!fb) {
-        Log.error(F("Camera capture failed"));
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+// encode into a pool slab, fails if the image does not fit
+static size_t jpg_encode_buffer(void * arg, size_t index, const void* data, size_t len){
+    jpg_buffer_t *j = (jpg_buffer_t *)arg;
+    if(!index){
+        j->len = 0;
     }
-
-    httpd_resp_set_type(req, "image/jpeg");
-    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
-
-    size_t fb_len = 0;
-    if(fb->format == PIXFORMAT_JPEG){
-        fb_len = fb->len;
-        res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-    } else {
-        jpg_chunking_t jchunk = {req, 0};
-        res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk)?ESP_OK:ESP_FAIL;
-        httpd_resp_send_chunk(req, NULL, 0);
-        fb_len = jchunk.len;
+    if(j->len + len > j->size){
+        return 0;
     }
-    esp_camera_fb_return(fb);
-    Log.notice(F("JPG: %u B "), (uint32_t)(fb_len));
-    return res;
+    memcpy(j->buf + j->len, data, len);
+    j->len += len;
+    return len;
 }
 
+// Raw frame encoding
+//
+// YUV422, RGB565 and grayscale frames go through the integer encoder in
+// jpeg_encoder.cpp, which streams through a scratch pool slab. Everything
+// else, or 'encoder camera', uses the encoder of the camera driver.
+bool jpeg_fast = true;
+
+// statistics
+uint32_t jpeg_encodes = 0;
+uint32_t jpeg_encode_us = 0;
+uint32_t jpeg_encode_pixels = 0;
+
+// jpeg_encoder.h format of a camera pixel format, -1 if it has none
+static int jpeg_format(pixformat_t format) {
+  if (format == PIXFORMAT_YUV422)
+    return JPEG_YUV422;
+  if (format == PIXFORMAT_RGB565)
+    return JPEG_RGB565;
+  if (format == PIXFORMAT_GRAYSCALE)
+    return JPEG_GRAYSCALE;
+  return -1;
+}
+
+static bool raw_encode(const uint8_t *src, size_t len, uint16_t width, uint16_t height,
+  pixformat_t format, uint8_t quality, jpg_out_cb cb, void *arg) {
+  int jformat = jpeg_format(format);
+  uint8_t *scratch = NULL;
+  bool ok;
+
+  if (jpeg_fast && jformat >= 0)
+    scratch = pool_get(POOL_SCRATCH);
+
+  unsigned long start = micros();
+  if (scratch) {
+    ok = jpeg_encode(src, width, height, jformat, quality, scratch,
+      pool_slab_size(POOL_SCRATCH), cb, arg);
+    pool_put(POOL_SCRATCH, scratch);
+  } else {
+    ok = fmt2jpg_cb((uint8_t *)src, len, width, height, format, quality, cb, arg);
+  }
+  if (ok) {
+    jpeg_encodes++;
+    jpeg_encode_us += micros() - start;
+    jpeg_encode_pixels += width * height;
+  }
+  return ok;
+}
+
+static bool frame_encode(camera_fb_t *fb, uint8_t quality, jpg_out_cb cb, void *arg) {
+  return raw_encode(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, cb, arg);
+}
+
+// encoder [fast|camera|reset]
+void command_encoder(String *in, unsigned int wordcounter) {
+  if (wordcounter == 1) {
+    if (in[1] == F("fast"))
+      jpeg_fast = true;
+    else if (in[1] == F("camera"))
+      jpeg_fast = false;
+    jpeg_encodes = jpeg_encode_us = jpeg_encode_pixels = 0;
+    return;
+  }
+  Log.notice(F("Encoder %s: %d frames"), jpeg_fast ? "fast" : "camera", jpeg_encodes);
+  if (jpeg_encodes && jpeg_encode_us) {
+    uint32_t us = jpeg_encode_us / jpeg_encodes;
+    Log.notice(F("Encoder: %d us per frame, %d frames/s, %d pixels/ms"), us,
+      1000000 / (us ? us : 1), (uint32_t)((uint64_t)jpeg_encode_pixels * 1000 / jpeg_encode_us));
+    mqtt_publish("encoder/frametime", us);
+  }
+}
+
+// Renditions
+//
+// One capture yields several JPEGs, e.g. the full frame and a thumbnail,
+// each encoded once and cached with the frame id. Consumers asking within
+// rendition_max_age share the cached frame instead of capturing again.
+// JPEG frames are decoded at a reduced scale for the thumbnail, raw frames
+// are subsampled. HTTP, WebSocket and RTSP all take their frames from here.
+// Encode slabs are taken per capture and returned when the last holder
+// releases an outdated set. tools/rendition_bench.cpp measures the encode
+// time per rendition on the host.
+#define RENDITION_FULL 0
+#define RENDITION_THUMB 1
+#define RENDITION_COUNT 2
+#define RENDITION_SLOTS 3 // held by WebSocket, sent over HTTP, being captured
+
+typedef struct {
+  const char *name;
+  uint8_t quality;
+  uint8_t scale;    // 1, 2, 4 or 8
+} rendition_config_t;
+
+typedef struct {
+  uint32_t frame_id;
+  unsigned long captured;
+  uint8_t refs;
+  uint8_t *buf[RENDITION_COUNT];
+  size_t len[RENDITION_COUNT];
+} rendition_set_t;
+
+rendition_config_t renditions[RENDITION_COUNT] = {
+  { "full", 80, 1 },
+  { "thumb", 60, 4 },
+};
+rendition_set_t rendition_cache[RENDITION_SLOTS];
+rendition_set_t *rendition_latest = NULL;
+SemaphoreHandle_t rendition_lock = NULL;     // cache bookkeeping
+SemaphoreHandle_t rendition_capture = NULL;  // one capture at a time
+unsigned int rendition_max_age = 200; // ms
+uint32_t frame_counter = 0;
+
+// statistics
+uint32_t rendition_frames = 0;
+uint32_t rendition_hits = 0;
+uint32_t rendition_frame_us = 0;
+uint32_t rendition_encodes[RENDITION_COUNT];
+uint32_t rendition_encode_us[RENDITION_COUNT];
+
+static bool rendition_encode(camera_fb_t *fb, unsigned int r, jpg_out_cb cb, void *arg) {
+  rendition_config_t *c = &renditions[r];
+
+  if (c->scale <= 1) {
+    if (fb->format != PIXFORMAT_JPEG)
+      return frame_encode(fb, c->quality, cb, arg);
+    // the sensor already did the work
+    return cb(arg, 0, fb->buf, fb->len) == fb->len;
+  }
+
+  uint8_t *raw = pool_get(POOL_FRAME);
+  uint16_t w, h;
+  pixformat_t format = fb->format;
+  bool ok = false;
+  if (!raw)
+    return false;
+
+  if (fb->format == PIXFORMAT_JPEG) {
+    jpg_scale_t scale = c->scale >= 8 ? JPG_SCALE_8X :
+      c->scale >= 4 ? JPG_SCALE_4X : JPG_SCALE_2X;
+    w = fb->width >> scale;
+    h = fb->height >> scale;
+    format = PIXFORMAT_RGB565;
+    ok = w * h * 2 <= pool_slab_size(POOL_FRAME) &&
+      jpg2rgb565(fb->buf, fb->len, raw, scale);
+  } else {
+    int jformat = jpeg_format(fb->format);
+    ok = jformat >= 0 && jpeg_subsample(fb->buf, fb->width, fb->height, jformat,
+      c->scale, raw, pool_slab_size(POOL_FRAME), &w, &h);
+  }
+  if (ok)
+    ok = raw_encode(raw, w * h * (format == PIXFORMAT_GRAYSCALE ? 1 : 2), w, h,
+      format, c->quality, cb, arg);
+  pool_put(POOL_FRAME, raw);
+  return ok;
+}
+
+// encode slabs go back to the pool as soon as nobody holds the set, so
+// without PSRAM a single slab serves every capture; call with the lock held
+static void rendition_free(rendition_set_t *set) {
+  for (unsigned int r = 0; r < RENDITION_COUNT; r++) {
+    pool_put(POOL_ENCODE, set->buf[r]);
+    set->buf[r] = NULL;
+    set->len[r] = 0;
+  }
+}
+
+// capture a frame and encode all renditions into a free cache slot
+static rendition_set_t *rendition_new() {
+  rendition_set_t *set = NULL;
+
+  xSemaphoreTake(rendition_lock, portMAX_DELAY);
+  // only called once the latest set is too old, let go of it unless held
+  if (rendition_latest && rendition_latest->refs == 0) {
+    rendition_free(rendition_latest);
+    rendition_latest = NULL;
+  }
+  for (int i = 0; i < RENDITION_SLOTS; i++) {
+    if (&rendition_cache[i] != rendition_latest && rendition_cache[i].refs == 0) {
+      set = &rendition_cache[i];
+      break;
+    }
+  }
+  xSemaphoreGive(rendition_lock);
+  if (!set)
+    return NULL;
+
+  camera_fb_t *fb = esp_camera_fb_get();
+  if (!fb) {
+    Log.error(F("Camera capture failed"));
+    return NULL;
+  }
+  unsigned long start = micros();
+  set->captured = millis();
+  for (unsigned int r = 0; r < RENDITION_COUNT; r++) {
+    set->len[r] = 0;
+    set->buf[r] = pool_get(POOL_ENCODE);
+    if (!set->buf[r])
+      continue;
+
+    jpg_buffer_t jbuf = { set->buf[r], pool_slab_size(POOL_ENCODE), 0 };
+    unsigned long t = micros();
+    if (rendition_encode(fb, r, jpg_encode_buffer, &jbuf)) {
+      set->len[r] = jbuf.len;
+      rendition_encodes[r]++;
+      rendition_encode_us[r] += micros() - t;
+    } else {
+      Log.error(F("Encoding rendition %s failed"), renditions[r].name);
+      pool_put(POOL_ENCODE, set->buf[r]);
+      set->buf[r] = NULL;
+    }
+  }
+  esp_camera_fb_return(fb);
+  rendition_frame_us += micros() - start;
+  rendition_frames++;
+
+  xSemaphoreTake(rendition_lock, portMAX_DELAY);
+  set->frame_id = ++frame_counter;
+  if (rendition_latest && rendition_latest->refs == 0)
+    rendition_free(rendition_latest);
+  rendition_latest = set;
+  xSemaphoreGive(rendition_lock);
+  return set;
+}
+
+static rendition_set_t *rendition_cached() {
+  rendition_set_t *set = NULL;
+
+  xSemaphoreTake(rendition_lock, portMAX_DELAY);
+  if (rendition_latest && millis() - rendition_latest->captured <= rendition_max_age) {
+    set = rendition_latest;
+    set->refs++;
+  }
+  xSemaphoreGive(rendition_lock);
+  return set;
+}
+
+// the current frame's renditions, release with rendition_release()
+rendition_set_t *rendition_get() {
+  rendition_set_t *set = rendition_cached();
+  if (set) {
+    rendition_hits++;
+    return set;
+  }
+
+  xSemaphoreTake(rendition_capture, portMAX_DELAY);
+  // somebody else may have captured while we waited
+  set = rendition_cached();
+  if (!set && rendition_new())
+    set = rendition_cached();
+  xSemaphoreGive(rendition_capture);
+  return set;
+}
+
+// another reference to a set the caller already holds
+void rendition_hold(rendition_set_t *set) {
+  xSemaphoreTake(rendition_lock, portMAX_DELAY);
+  set->refs++;
+  xSemaphoreGive(rendition_lock);
+}
+
+void rendition_release(rendition_set_t *set) {
+  xSemaphoreTake(rendition_lock, portMAX_DELAY);
+  if (--set->refs == 0 && set != rendition_latest)
+    rendition_free(set);
+  xSemaphoreGive(rendition_lock);
+}
+
+int rendition_find(const char *name) {
+  for (int r = 0; r < RENDITION_COUNT; r++) {
+    if (!strcmp(name, renditions[r].name))
+      return r;
+  }
+  return -1;
+}
+
+void setup_renditions() {
+  rendition_lock = xSemaphoreCreateMutex();
+  rendition_capture = xSemaphoreCreateMutex();
+}
+
+void log_renditions() {
+  Log.notice(F("Renditions: %d frames, %d cache hits"), rendition_frames, rendition_hits);
+  if (rendition_frames)
+    Log.notice(F("Renditions: %d us per frame"), rendition_frame_us / rendition_frames);
+  for (unsigned int r = 0; r < RENDITION_COUNT; r++) {
+    if (rendition_encodes[r])
+      Log.notice(F("Rendition %s: quality %d, 1/%d, %d us"), renditions[r].name,
+        renditions[r].quality, renditions[r].scale,
+        rendition_encode_us[r] / rendition_encodes[r]);
+  }
+}
+
+// rendition [<name> quality|scale <n>]
+void command_rendition(String *in, unsigned int wordcounter) {
+  if (wordcounter == 0) {
+    log_renditions();
+    mqtt_publish("rendition/frames", rendition_frames);
+    mqtt_publish("rendition/hits", rendition_hits);
+    if (rendition_frames)
+      mqtt_publish("rendition/frametime", rendition_frame_us / rendition_frames);
+    return;
+  }
+  int r = rendition_find(in[1].c_str());
+  if (r < 0 || wordcounter != 3)
+    return;
+  int v = in[3].toInt();
+  if (in[2] == F("quality") && v > 0 && v <= 100)
+    renditions[r].quality = v;
+  if (in[2] == F("scale") && (v == 1 || v == 2 || v == 4 || v == 8))
+    renditions[r].scale = v;
+}
+
+// Event clips
+//
+// While enabled, the last frames are kept in a ring inside one PSRAM
+// arena. A trigger freezes the frames of the last clip_pre ms, keeps
+// recording for clip_post ms and then holds the clip until it has been
+// fetched from /clip (multipart/mixed) or sent by 'clip mqtt', released,
+// or clip_hold ms have passed. The arena bounds the memory, post event
+// recording stops early when it is full.
+// HTTP workers read the held clip while the loop task runs the ring.
+// clip_lock guards the state and the reader count. A release asked for
+// while a reader is busy is done by the loop task once the last one is
+// finished, so frames never change under a reader.
+#define CLIP_IDLE 0
+#define CLIP_RECORDING 1
+#define CLIP_READY 2
+#define CLIP_MAX_FRAMES 100
+
+typedef struct {
+  uint32_t offset;
+  uint32_t len;
+  unsigned long captured;
+} clip_frame_t;
+
+uint8_t *clip_arena = NULL;
+size_t clip_arena_size = 0;
+clip_frame_t clip_frames[CLIP_MAX_FRAMES];
+unsigned int clip_first = 0;      // oldest frame in the ring
+unsigned int clip_count = 0;
+unsigned int clip_frozen = 0;     // frames from clip_first on that must stay
+SemaphoreHandle_t clip_lock = NULL;
+uint8_t clip_state = CLIP_IDLE;
+uint8_t clip_readers = 0;          // /clip responses in progress
+bool clip_release_pending = false; // release when the readers are done
+bool clip_clear_pending = false;   // and empty the ring
+bool clip_enabled = false;
+unsigned int clip_interval = 200;  // ms between frames
+unsigned int clip_pre = 5000;      // ms before the trigger
+unsigned int clip_post = 5000;     // ms after the trigger
+unsigned int clip_hold = 60000;    // ms a finished clip is kept
+unsigned long clip_last_frame = 0;
+unsigned long clip_trigger_time = 0;
+unsigned long clip_ready_time = 0;
+unsigned int clip_mqtt_next = 0;   // next frame to publish, 0 if idle
+bool clip_mqtt = false;
+
+// statistics
+uint32_t clip_triggers = 0;
+
+static clip_frame_t *clip_frame(unsigned int i) {
+  return &clip_frames[(clip_first + i) % CLIP_MAX_FRAMES];
+}
+
+size_t clip_bytes() {
+  size_t n = 0;
+  for (unsigned int i = 0; i < clip_count; i++)
+    n += clip_frame(i)->len;
+  return n;
+}
+
+static void clip_drop_oldest() {
+  clip_first = (clip_first + 1) % CLIP_MAX_FRAMES;
+  clip_count--;
+}
+
+// make room for len bytes after the newest frame, false if frozen frames are in the way
+static bool clip_reserve(size_t len, uint32_t *offset) {
+  if (len > clip_arena_size)
+    return false;
+
+  uint32_t start = 0;
+  if (clip_count) {
+    clip_frame_t *last = clip_frame(clip_count - 1);
+    start = last->offset + last->len;
+    if (start + len > clip_arena_size)
+      start = 0;  // wrap around
+  }
+
+  // evict frames overlapping [start, start + len)
+  while (clip_count && clip_count == CLIP_MAX_FRAMES) {
+    if (clip_frozen)
+      return false;
+    clip_drop_oldest();
+  }
+  while (clip_count) {
+    clip_frame_t *f = clip_frame(0);
+    if (f->offset + f->len <= start || f->offset >= start + len)
+      break;
+    if (clip_frozen)
+      return false;
+    clip_drop_oldest();
+  }
+  *offset = start;
+  return true;
+}
+
+static void clip_set_state(uint8_t state) {
+  xSemaphoreTake(clip_lock, portMAX_DELAY);
+  clip_state = state;
+  xSemaphoreGive(clip_lock);
+}
+
+static void clip_store(const uint8_t *jpg, size_t len, unsigned long captured) {
+  uint32_t offset;
+
+  if (!clip_reserve(len, &offset)) {
+    if (clip_state == CLIP_RECORDING) {
+      Log.notice(F("Clip arena full, ending post event recording"));
+      clip_set_state(CLIP_READY);
+    }
+    return;
+  }
+  memcpy(clip_arena + offset, jpg, len);
+  clip_frame_t *f = &clip_frames[(clip_first + clip_count) % CLIP_MAX_FRAMES];
+  f->offset = offset;
+  f->len = len;
+  f->captured = captured;
+  clip_count++;
+  if (clip_state == CLIP_RECORDING)
+    clip_frozen = clip_count;
+
+  // while idle only the pre event window is worth keeping
+  while (clip_state == CLIP_IDLE && clip_count > 1 &&
+         captured - clip_frame(0)->captured > clip_pre)
+    clip_drop_oldest();
+}
+
+void clip_trigger(const char *reason) {
+  if (!clip_arena || !clip_enabled || clip_state != CLIP_IDLE)
+    return;
+  clip_trigger_time = millis();
+  clip_triggers++;
+
+  // freeze the pre event window, older frames may be overwritten
+  while (clip_count && clip_trigger_time - clip_frame(0)->captured > clip_pre)
+    clip_drop_oldest();
+  clip_frozen = clip_count;
+  clip_set_state(CLIP_RECORDING);
+  Log.notice(F("Clip triggered by %s, %d frames before"), reason, clip_count);
+}
+
+// back to recording the ring, emptied with clear; deferred while the
+// clip is being read
+static void clip_release(bool clear) {
+  if (!clip_lock)
+    return;
+  xSemaphoreTake(clip_lock, portMAX_DELAY);
+  if (clip_readers) {
+    clip_release_pending = true;
+    clip_clear_pending |= clear;
+  } else {
+    clip_state = CLIP_IDLE;
+    clip_frozen = 0;
+    clip_mqtt_next = 0;
+    clip_mqtt = false;
+    if (clear || clip_clear_pending)
+      clip_count = 0;
+    clip_release_pending = false;
+    clip_clear_pending = false;
+  }
+  xSemaphoreGive(clip_lock);
+}
+
+// false if there is no clip to read, call clip_read_end() when done
+static bool clip_read_begin() {
+  bool ok = false;
+
+  if (!clip_lock)
+    return false;
+  xSemaphoreTake(clip_lock, portMAX_DELAY);
+  if (clip_state == CLIP_READY && !clip_release_pending) {
+    clip_readers++;
+    ok = true;
+  }
+  xSemaphoreGive(clip_lock);
+  return ok;
+}
+
+static void clip_read_end() {
+  xSemaphoreTake(clip_lock, portMAX_DELAY);
+  clip_readers--;
+  xSemaphoreGive(clip_lock);
+}
+
+// publish one frame per call, so the loop keeps running
+static void clip_publish_next() {
+  char topic[60];
+
+  if (clip_mqtt_next == 0) {
+    char info[48];
+    snprintf(info, sizeof(info), "%u %u %lu", clip_count, (unsigned int)clip_bytes(),
+      clip_ready_time - clip_trigger_time);
+    mqtt_publish("clip/info", info);
+  }
+  if (clip_mqtt_next < clip_count) {
+    clip_frame_t *f = clip_frame(clip_mqtt_next);
+    snprintf(topic, sizeof(topic), "/%s/%s/clip/%u", Ssite.c_str(), Sroom.c_str(), clip_mqtt_next);
+    if (!client.beginPublish(topic, f->len, false) ||
+        client.write(clip_arena + f->offset, f->len) != f->len ||
+        !client.endPublish()) {
+      Log.error(F("Publishing clip frame %d failed"), clip_mqtt_next);
+      return; // try again later
+    }
+    clip_mqtt_next++;
+  }
+  if (clip_mqtt_next >= clip_count) {
+    Log.notice(F("Clip sent via MQTT"));
+    clip_release(false);
+  }
+}
+
+void loop_clip() {
+  if (!clip_arena)
+    return;
+  if (clip_release_pending)
+    clip_release(false);
+  if (!clip_enabled || !camera_found)
+    return;
+
+  if (clip_state == CLIP_READY) {
+    if (clip_mqtt && client.connected())
+      clip_publish_next();
+    else if (!clip_release_pending && millis() - clip_ready_time > clip_hold)
+      clip_release(false);
+    return;
+  }
+
+  if (clip_state == CLIP_RECORDING && millis() - clip_trigger_time >= clip_post) {
+    clip_set_state(CLIP_READY);
+    clip_ready_time = millis();
+    Log.notice(F("Clip ready: %d frames, %d B, %d ms after trigger"), clip_count,
+      clip_bytes(), clip_ready_time - clip_trigger_time);
+    return;
+  }
+
+  if (millis() - clip_last_frame < clip_interval)
+    return;
+  clip_last_frame = millis();
+
+  rendition_set_t *set = rendition_get();
+  if (!set)
+    return;
+  if (set->len[RENDITION_FULL])
+    clip_store(set->buf[RENDITION_FULL], set->len[RENDITION_FULL], set->captured);
+  rendition_release(set);
+  if (clip_state == CLIP_READY)
+    clip_ready_time = millis();
+}
+
+void setup_clip() {
+  if (!psramFound())
+    return;
+  clip_lock = xSemaphoreCreateMutex();
+  clip_arena_size = 1024 * 1024;
+  clip_arena = (uint8_t *)heap_caps_malloc(clip_arena_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!clip_arena)
+    clip_arena_size = 0;
+  Log.notice(F("Clip arena: %d B"), clip_arena_size);
+}
+
+void log_clip() {
+  const char *states[] = { "idle", "recording", "ready" };
+  Log.notice(F("Clip %s, %s: %d frames, %d of %d B"), clip_enabled ? "on" : "off",
+    states[clip_state], clip_count, clip_bytes(), clip_arena_size);
+  Log.notice(F("Clip: %d triggers, last available %d ms after trigger"),
+    clip_triggers, clip_ready_time - clip_trigger_time);
+}
+
+// clip [on|off|trigger|release|mqtt|pre <ms>|post <ms>]
+void command_clip(String *in, unsigned int wordcounter) {
+  if (wordcounter == 0) {
+    log_clip();
+    mqtt_publish("clip/bytes", (uint32_t)clip_bytes());
+    mqtt_publish("clip/frames", clip_count);
+  } else if (in[1] == F("on")) {
+    clip_enabled = clip_arena != NULL;
+  } else if (in[1] == F("off")) {
+    clip_enabled = false;
+    clip_release(true);
+  } else if (in[1] == F("trigger")) {
+    clip_trigger("command");
+  } else if (in[1] == F("release")) {
+    clip_release(false);
+  } else if (in[1] == F("mqtt")) {
+    clip_mqtt = (clip_state == CLIP_READY);
+  } else if (wordcounter == 2 && in[2].toInt() > 0) {
+    if (in[1] == F("pre"))
+      clip_pre = in[2].toInt();
+    if (in[1] == F("post"))
+      clip_post = in[2].toInt();
+  }
+}
+
+// Configuration
+//
+// Every setting is one entry in config_fields: its place in config.json,
+// its name for the config command, type, default, valid range and what a
+// change needs to take effect. The entries point at the globals they set.
+// config_schema.h handles defaults, validation and the binary copy, this
+// section adds SPIFFS, JSON and the config command.
+//
+// At boot the settings come from /config.bin. /config.json is only parsed
+// when that is missing or broken, e.g. after uploading a new file system
+// image, and is still written on "config write" for editing and backup.
+#define CONFIG_JSON "/config.json"
+#define CONFIG_BIN "/config.bin"
+#define CONFIG_BIN_MAX 1024
+
+// reconnects owed to runtime changes, done from loop_config()
+#define CONFIG_RECONNECT_MQTT 1
+#define CONFIG_RECONNECT_WIFI 2
+uint8_t config_pending = 0;
+
+static void config_apply_mqtt() {
+  config_pending |= CONFIG_RECONNECT_MQTT;
+}
+
+static void config_apply_wifi() {
+  config_pending |= CONFIG_RECONNECT_WIFI;
+}
+
+// the decoder needs a key frame in the new mode, as after "telemetry <mode>"
+static void config_apply_telemetry() {
+  telemetry_reset(&telemetry);
+}
+
+constexpr config_field_t config_fields[] = {
+  { 1, NULL, "myname", "myname", CONFIG_STRING, &Smyname, "esp-camera", 0, 1, 32, config_apply_mqtt },
+  { 2, NULL, "flipped", "flipped", CONFIG_BOOL, &Bflipped, NULL, 0, 0, 1, NULL },
+  { 3, "network", "ssid", "ssid", CONFIG_STRING, &Sssid, "", 0, 0, 32, config_apply_wifi },
+  { 4, "network", "pass", "wifipass", CONFIG_STRING, &Spass, "", 0, 0, 64, config_apply_wifi },
+  { 5, "mqtt", "server", "mqttserver", CONFIG_STRING, &Smqttserver, "", 0, 0, 64, config_apply_mqtt },
+  { 6, "mqtt", "port", "mqttport", CONFIG_UINT, &Imqttport, NULL, 1883, 1, 65535, config_apply_mqtt },
+  { 7, "mqtt", "user", "mqttuser", CONFIG_STRING, &Smqttuser, "", 0, 0, 32, config_apply_mqtt },
+  { 8, "mqtt", "pass", "mqttpass", CONFIG_STRING, &Smqttpass, "", 0, 0, 64, config_apply_mqtt },
+  { 9, "location", "site", "site", CONFIG_STRING, &Ssite, "", 0, 0, 20, NULL },
+  { 10, "location", "room", "room", CONFIG_STRING, &Sroom, "", 0, 0, 20, NULL },
+  { 11, "power", "dutycycle", "dutycycle", CONFIG_BOOL, &Bdutycycle, NULL, 0, 0, 1, NULL },
+  { 12, "power", "interval", "dutyinterval", CONFIG_UINT, &Idutyinterval, NULL, 300, 10, 86400, NULL },
+  { 13, "power", "snapshot", "dutysnapshot", CONFIG_UINT, &Idutysnapshot, NULL, 0, 0, 255, NULL },
+  { 14, "loop", "budget", "loopbudget", CONFIG_UINT, &loop_budget, NULL, 100, 1, 60000, NULL },
+  { 15, "telemetry", "mode", "telemetrymode", CONFIG_UINT, &telemetry_mode, NULL, TELEMETRY_TEXT, 1, 3, config_apply_telemetry },
+  { 16, "clip", "enabled", "clip", CONFIG_BOOL, &clip_enabled, NULL, 0, 0, 1, NULL },
+  { 17, "clip", "pre", "clippre", CONFIG_UINT, &clip_pre, NULL, 5000, 0, 60000, NULL },
+  { 18, "clip", "post", "clippost", CONFIG_UINT, &clip_post, NULL, 5000, 0, 60000, NULL },
+  { 19, "clip", "interval", "clipinterval", CONFIG_UINT, &clip_interval, NULL, 200, 20, 5000, NULL },
+};
+#define CONFIG_FIELD_COUNT (sizeof(config_fields) / sizeof(config_fields[0]))
+
+static_assert(config_ids_unique(config_fields), "config field ids must be unique");
+static_assert(config_defaults_valid(config_fields), "config defaults must be in range");
+
+static const char *config_string_get(const void *value) {
+  return ((const String *)value)->c_str();
+}
+
+static void config_string_set(void *value, const char *s) {
+  *(String *)value = s;
+}
+
+const config_schema_t config_schema = {
+  config_fields, CONFIG_FIELD_COUNT, config_string_get, config_string_set
+};
+
+static bool config_read_bin() {
+  uint8_t buf[CONFIG_BIN_MAX];
+
+  File f = SPIFFS.open(CONFIG_BIN, "r");
+  if (!f)
+    return false;
+  size_t size = f.read(buf, sizeof(buf));
+  f.close();
+  int invalid = config_decode(&config_schema, buf, size);
+  if (invalid < 0) {
+    Log.error(F("Ignoring broken %s"), CONFIG_BIN);
+    return false;
+  }
+  if (invalid)
+    Log.error(F("%d invalid values in %s"), invalid, CONFIG_BIN);
+  return true;
+}
+
+static bool config_write_bin() {
+  uint8_t buf[CONFIG_BIN_MAX];
+  size_t len = config_encode(&config_schema, buf, sizeof(buf));
+
+  File f = SPIFFS.open(CONFIG_BIN, "w");
+  if (!len || !f || f.write(buf, len) != len) {
+    Log.error(F("Writing %s failed"), CONFIG_BIN);
+    if (f)
+      f.close();
+    return false;
+  }
+  f.close();
+  return true;
+}
+
+static bool config_read_json() {
+  File f = SPIFFS.open(CONFIG_JSON, "r");
+  if (!f) {
+    Log.error(F("Cannot open config file"));
+    return false;
+  }
+  DynamicJsonBuffer jsonBuffer(1024);
+  JsonObject &root = jsonBuffer.parseObject(f);
+  f.close();
+  if (!root.success()) {
+    Log.error(F("Failed to read %s"), CONFIG_JSON);
+    return false;
+  }
+
+  for (unsigned int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    const config_field_t *c = &config_fields[i];
+    JsonObject &section = c->section ? root[c->section].as<JsonObject&>() : root;
+    JsonVariant v = section[c->key];
+    // missing keys keep their default
+    if (v.success() && !config_parse(&config_schema, c, v.as<String>().c_str()))
+      Log.error(F("Config %s: invalid value in %s"), c->name, CONFIG_JSON);
+  }
+  return true;
+}
+
+static bool config_write_json() {
+  DynamicJsonBuffer jsonBuffer(1024);
+  JsonObject &root = jsonBuffer.createObject();
+
+  for (unsigned int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    const config_field_t *c = &config_fields[i];
+    JsonObject &section = !c->section ? root : root.containsKey(c->section) ?
+      root[c->section].as<JsonObject&>() : root.createNestedObject(c->section);
+    if (c->type == CONFIG_STRING)
+      section[c->key] = *(String *)c->value;
+    else if (c->type == CONFIG_UINT)
+      section[c->key] = *(unsigned int *)c->value;
+    else
+      section[c->key] = *(bool *)c->value;
+  }
+  root.prettyPrintTo(Serial);
+
+  File f = SPIFFS.open(CONFIG_JSON, "w");
+  if (!f) {
+    Log.error(F("Open of config file for writing failed"));
+    return false;
+  }
+  bool ok = root.printTo(f) > 0;
+  if (!ok)
+    Log.error(F("Writing object into file failed"));
+  f.close();
+  return ok;
+}
+
+void log_config() {
+  for (unsigned int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    const config_field_t *c = &config_fields[i];
+    if (c->type == CONFIG_STRING)
+      Log.verbose(F("%s = %s"), c->name, ((String *)c->value)->c_str());
+    else if (c->type == CONFIG_UINT)
+      Log.verbose(F("%s = %d"), c->name, *(unsigned int *)c->value);
+    else
+      Log.verbose(F("%s = %T"), c->name, *(bool *)c->value);
+  }
+}
+
+void write_config() {
+  Log.notice(F("Writing new config file"));
+  SPIFFS.begin();
+  if (config_write_json() && config_write_bin())
+    Log.notice(F("Written new config. Now reboot"));
+  SPIFFS.end();
+}
+
+// read the config, binary if possible, and parse its data
+void setup_readconfig() {
+  unsigned long start = micros();
+
+  config_defaults(&config_schema);
+  SPIFFS.begin();
+  bool from_bin = config_read_bin();
+  bool from_json = !from_bin && config_read_json();
+  Log.notice(F("Config loaded from %s in %d us"),
+    from_bin ? CONFIG_BIN : from_json ? CONFIG_JSON : "defaults", micros() - start);
+  // keep the binary copy for the next boot
+  if (from_json)
+    config_write_bin();
+  SPIFFS.end();
+}
+
+// reconnect with changed settings, outside of mqtt_callback; mqtt_reconnect
+// runs setup_wifi again once WiFi is down
+void loop_config() {
+  if (!config_pending)
+    return;
+  if (config_pending & CONFIG_RECONNECT_WIFI)
+    WiFi.disconnect();
+  client.disconnect();
+  setup_mqtt();
+  lastReconnectAttempt = 0;
+  config_pending = 0;
+  Log.notice(F("Reconnecting with new settings"));
+}
+
+// config                  log all settings
+// config write            save config.json and config.bin
+// config import           read config.json again, e.g. after editing it
+// config <name> <value>   takes effect at once, see the apply hooks
+void command_config(String *in, unsigned int wordcounter) {
+  if (wordcounter == 0) {
+    log_config();
+  } else if (wordcounter == 1 && in[1] == F("write")) {
+    log_config();
+    write_config();
+  } else if (wordcounter == 1 && in[1] == F("import")) {
+    SPIFFS.begin();
+    if (config_read_json()) {
+      config_write_bin();
+      config_apply_all(&config_schema);
+    }
+    SPIFFS.end();
+    log_config();
+  } else if (wordcounter == 2) {
+    const config_field_t *c = config_find(&config_schema, in[1].c_str());
+    if (!c)
+      Log.error(F("Unknown config %s"), in[1].c_str());
+    else if (!config_parse(&config_schema, c, in[2].c_str()))
+      Log.error(F("Invalid value %s for %s"), in[2].c_str(), c->name);
+    else if (c->apply)
+      c->apply();
+  }
+}
+
+// capture-to-sent latency of polled images, to compare with the websocket
+uint32_t http_frames = 0;
+uint32_t http_latency_sum = 0;
+
+// direct capture, used when no cached rendition is available
+static esp_err_t index_capture(httpd_req_t *req){
+    camera_fb_t * fb = NULL;
+    esp_err_t res = ESP_OK;
+
+    fb = esp_camera_fb_get();
+    if (!fb) {
+        Log.error(F("Camera capture failed"));
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    unsigned long captured = millis();
+
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+
+    size_t fb_len = 0;
+    if(fb->format == PIXFORMAT_JPEG){
+        fb_len = fb->len;
+        res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
+    } else {
+        jpg_buffer_t jbuf = {pool_get(POOL_ENCODE), pool_slab_size(POOL_ENCODE), 0};
+        if (jbuf.buf && frame_encode(fb, 80, jpg_encode_buffer, &jbuf)) {
+            fb_len = jbuf.len;
+            res = httpd_resp_send(req, (const char *)jbuf.buf, jbuf.len);
+        } else {
+            // no slab free or image too large, stream it instead
+            jpg_chunking_t jchunk = {req, 0};
+            res = frame_encode(fb, 80, jpg_encode_stream, &jchunk)?ESP_OK:ESP_FAIL;
+            httpd_resp_send_chunk(req, NULL, 0);
+            fb_len = jchunk.len;
+        }
+        pool_put(POOL_ENCODE, jbuf.buf);
+    }
+    esp_camera_fb_return(fb);
+    if (res == ESP_OK) {
+        http_frames++;
+        http_latency_sum += millis() - captured;
+    }
+    Log.notice(F("JPG: %u B "), (uint32_t)(fb_len));
+    return res;
+}
+
+// send a cached rendition from inside the handler
+static esp_err_t index_send(httpd_req_t *req, int r){
+    rendition_set_t *set = rendition_get();
+    if (!set || !set->len[r]) {
+        if (set)
+            rendition_release(set);
+        if (r == RENDITION_FULL)
+            return index_capture(req);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    char id[12];
+    snprintf(id, sizeof(id), "%lu", (unsigned long)set->frame_id);
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+    httpd_resp_set_hdr(req, "X-Frame-Id", id);
+    esp_err_t res = httpd_resp_send(req, (const char *)set->buf[r], set->len[r]);
+    if (res == ESP_OK) {
+        http_frames++;
+        http_latency_sum += millis() - set->captured;
+    }
+    Log.notice(F("JPG %s: %u B "), renditions[r].name, (uint32_t)set->len[r]);
+    rendition_release(set);
+    return res;
+}
+
+
+// HTTP workers
+//
+// Images are not sent from the server task. index_handler queues a job
+// and returns, one of the workers captures and writes the response
+// straight to the socket with a send timeout, then closes the connection.
+// A slow client so only holds up one worker, and the server task stays
+// free for other requests. A full queue is answered with 503.
+// No lock is held while sending. Every job has a slot from the moment it
+// is queued until its worker is done with it. If the server lets go of a
+// session that is still queued or being written to, the close callback
+// only flags the slot, and shuts the socket down if a worker is sending,
+// and the worker closes the fd, so it cannot be reused under a job.
+#define HTTP_WORKERS 2
+#define HTTP_QUEUE_LEN 4
+#define HTTP_SEND_TIMEOUT 5   // s per chunk
+#define HTTP_CHUNK 4096
+#define HTTP_LATENCY_BUCKETS 16
+
+#define HTTP_JOB_IMAGE 0
+#define HTTP_JOB_CLIP 1
+
+// job slots, at most one per worker and one per queue entry
+#define HTTP_SLOTS (HTTP_WORKERS + HTTP_QUEUE_LEN)
+
+#define HTTP_FREE 0
+#define HTTP_QUEUED 1
+#define HTTP_BUSY 2
+#define HTTP_CANCELLED 3  // the server closed the session, the worker closes the fd
+
+typedef struct {
+  int fd;
+  int kind;
+  int rendition;
+  unsigned long queued;
+  volatile int state;
+} http_job_t;
+
+typedef struct {
+  TaskHandle_t task;
+  http_job_t *job;
+} http_worker_t;
+
+QueueHandle_t http_queue = NULL;  // of http_job_t *
+http_job_t http_jobs[HTTP_SLOTS];
+http_worker_t http_workers[HTTP_WORKERS];
+
+// statistics, request latency from queueing to the last byte sent
+uint32_t http_served = 0;
+uint32_t http_rejected = 0;
+uint32_t http_failed = 0;
+uint32_t http_latency_histogram[HTTP_LATENCY_BUCKETS];  // ms, power of two buckets
+
+// called by the server when it closes a session, true if a job for fd is
+// still queued or being written and its worker will close the fd
+bool http_cancel(int fd) {
+  for (int i = 0; i < HTTP_SLOTS; i++) {
+    http_job_t *job = &http_jobs[i];
+    int state = __atomic_load_n(&job->state, __ATOMIC_ACQUIRE);
+    if ((state == HTTP_QUEUED || state == HTTP_BUSY) && job->fd == fd &&
+        __atomic_compare_exchange_n(&job->state, &state, HTTP_CANCELLED,
+          false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      // make a blocked send return now instead of after its timeout
+      if (state == HTTP_BUSY)
+        shutdown(fd, SHUT_RDWR);
+      return true;
+    }
+  }
+  return false;
+}
+
+// a free slot for a new job, only the server task claims slots
+static http_job_t *http_job_claim(int fd, int kind, int rendition) {
+  for (int i = 0; i < HTTP_SLOTS; i++) {
+    http_job_t *job = &http_jobs[i];
+    if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != HTTP_FREE)
+      continue;
+    job->fd = fd;
+    job->kind = kind;
+    job->rendition = rendition;
+    job->queued = millis();
+    __atomic_store_n(&job->state, HTTP_QUEUED, __ATOMIC_RELEASE);
+    return job;
+  }
+  return NULL;
+}
+
+// queue a job for fd, false if all workers and queue entries are taken
+static bool http_job_queue(int fd, int kind, int rendition) {
+  http_job_t *job = http_queue ? http_job_claim(fd, kind, rendition) : NULL;
+
+  if (!job)
+    return false;
+  if (xQueueSend(http_queue, &job, 0) != pdTRUE) {
+    __atomic_store_n(&job->state, HTTP_FREE, __ATOMIC_RELEASE);
+    return false;
+  }
+  return true;
+}
+
+static bool http_write(http_worker_t *w, const uint8_t *data, size_t len) {
+  while (len) {
+    size_t n = len > HTTP_CHUNK ? HTTP_CHUNK : len;
+
+    if (__atomic_load_n(&w->job->state, __ATOMIC_ACQUIRE) == HTTP_CANCELLED)
+      return false;
+    int sent = send(w->job->fd, data, n, 0);
+    if (sent <= 0)
+      return false;
+    data += sent;
+    len -= sent;
+  }
+  return true;
+}
+
+static size_t http_write_stream(void *arg, size_t index, const void *data, size_t len) {
+  return http_write((http_worker_t *)arg, (const uint8_t *)data, len) ? len : 0;
+}
+
+static void http_count_latency(http_job_t *job) {
+  uint32_t ms = millis() - job->queued;
+  unsigned int b = ms ? 32 - __builtin_clz(ms) : 0;
+  http_latency_histogram[b < HTTP_LATENCY_BUCKETS ? b : HTTP_LATENCY_BUCKETS - 1]++;
+}
+
+// direct capture, used when no cached rendition is available; the length
+// is not known up front, the end of the connection ends the image
+static void http_respond_capture(http_worker_t *w, http_job_t *job) {
+  camera_fb_t *fb = esp_camera_fb_get();
+  if (!fb) {
+    Log.error(F("Camera capture failed"));
+    const char *err = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    http_write(w, (const uint8_t *)err, strlen(err));
+    http_failed++;
+    return;
+  }
+  unsigned long captured = millis();
+
+  const char *header = "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\n"
+    "Content-Disposition: inline; filename=capture.jpg\r\nConnection: close\r\n\r\n";
+  bool ok = http_write(w, (const uint8_t *)header, strlen(header)) &&
+    rendition_encode(fb, job->rendition, http_write_stream, w);
+  esp_camera_fb_return(fb);
+  if (ok) {
+    http_count_latency(job);
+    http_served++;
+    http_frames++;
+    http_latency_sum += millis() - captured;
+  } else {
+    Log.error(F("HTTP client %d too slow or gone"), job->fd);
+    http_failed++;
+  }
+}
+
+static void http_respond(http_worker_t *w, http_job_t *job) {
+  char header[200];
+  rendition_set_t *set = rendition_get();
+
+  if (!set || !set->len[job->rendition]) {
+    if (set)
+      rendition_release(set);
+    http_respond_capture(w, job);
+    return;
+  }
+
+  size_t len = set->len[job->rendition];
+  int n = snprintf(header, sizeof(header),
+    "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n"
+    "Content-Disposition: inline; filename=capture.jpg\r\nX-Frame-Id: %lu\r\n"
+    "Connection: close\r\n\r\n", (unsigned int)len, (unsigned long)set->frame_id);
+  if (http_write(w, (const uint8_t *)header, n) &&
+      http_write(w, set->buf[job->rendition], len)) {
+    http_count_latency(job);
+    http_served++;
+    http_frames++;
+    http_latency_sum += millis() - set->captured;
+  } else {
+    Log.error(F("HTTP client %d too slow or gone"), job->fd);
+    http_failed++;
+  }
+  rendition_release(set);
+}
+
+// the held clip as multipart/mixed, one JPEG per part
+static void http_respond_clip(http_worker_t *w, http_job_t *job) {
+  char header[160];
+
+  if (!clip_read_begin()) {
+    const char *err = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    http_write(w, (const uint8_t *)err, strlen(err));
+    return;
+  }
+
+  const char *start = "HTTP/1.1 200 OK\r\nContent-Type: multipart/mixed; boundary=clipframe\r\n"
+    "Content-Disposition: attachment; filename=clip.mjpeg\r\nConnection: close\r\n\r\n";
+  bool ok = http_write(w, (const uint8_t *)start, strlen(start));
+  for (unsigned int i = 0; ok && i < clip_count; i++) {
+    clip_frame_t *f = clip_frame(i);
+    int n = snprintf(header, sizeof(header),
+      "--clipframe\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\nX-Offset-Ms: %ld\r\n\r\n",
+      (unsigned int)f->len, (long)(f->captured - clip_trigger_time));
+    ok = http_write(w, (const uint8_t *)header, n) &&
+      http_write(w, clip_arena + f->offset, f->len) &&
+      http_write(w, (const uint8_t *)"\r\n", 2);
+  }
+  if (ok)
+    ok = http_write(w, (const uint8_t *)"--clipframe--\r\n", 15);
+  clip_read_end();
+  if (ok)
+    http_served++;
+  else
+    http_failed++;
+}
+
+static void http_worker_task(void *arg) {
+  http_worker_t *w = (http_worker_t *)arg;
+  http_job_t *job;
+  struct timeval tv = { HTTP_SEND_TIMEOUT, 0 };
+
+  for (;;) {
+    if (xQueueReceive(http_queue, &job, portMAX_DELAY) != pdTRUE)
+      continue;
+
+    // the session closed while the job was queued, the fd was left to us
+    int queued = HTTP_QUEUED;
+    if (!__atomic_compare_exchange_n(&job->state, &queued, HTTP_BUSY,
+          false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      close(job->fd);
+      http_failed++;
+      __atomic_store_n(&job->state, HTTP_FREE, __ATOMIC_RELEASE);
+      continue;
+    }
+    w->job = job;
+
+    setsockopt(job->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (job->kind == HTTP_JOB_CLIP)
+      http_respond_clip(w, job);
+    else
+      http_respond(w, job);
+
+    // ask for the close while the fd is still ours, so it cannot have been
+    // reused by then; the close callback either sees the slot free and
+    // closes the fd itself or has already cancelled it and left it to us
+    int fd = job->fd;
+    httpd_sess_trigger_close(camera_httpd, fd);
+    int busy = HTTP_BUSY;
+    if (!__atomic_compare_exchange_n(&job->state, &busy, HTTP_FREE,
+          false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      close(fd);
+      __atomic_store_n(&job->state, HTTP_FREE, __ATOMIC_RELEASE);
+    }
+    w->job = NULL;
+  }
+}
+
+void setup_http_workers() {
+  http_queue = xQueueCreate(HTTP_QUEUE_LEN, sizeof(http_job_t *));
+  if (!http_queue)
+    return;
+  for (int i = 0; i < HTTP_SLOTS; i++)
+    http_jobs[i].state = HTTP_FREE;
+  for (int i = 0; i < HTTP_WORKERS; i++) {
+    http_workers[i].job = NULL;
+    xTaskCreate(http_worker_task, "http_worker", 4096, &http_workers[i], 5,
+      &http_workers[i].task);
+  }
+}
+
+// approximate percentile in ms from the latency histogram
+uint32_t http_latency_percentile(unsigned int percent) {
+  uint32_t total = 0, sum = 0;
+  for (unsigned int b = 0; b < HTTP_LATENCY_BUCKETS; b++)
+    total += http_latency_histogram[b];
+  for (unsigned int b = 0; b < HTTP_LATENCY_BUCKETS; b++) {
+    sum += http_latency_histogram[b];
+    if (total && sum * 100 >= total * percent)
+      return b ? 1UL << b : 0;  // upper bound of the bucket
+  }
+  return 0;
+}
+
+void log_http() {
+  Log.notice(F("HTTP: %d served, %d rejected, %d failed, %d waiting"),
+    http_served, http_rejected, http_failed,
+    http_queue ? uxQueueMessagesWaiting(http_queue) : 0);
+  Log.notice(F("HTTP latency: p50 < %d ms, p99 < %d ms"),
+    http_latency_percentile(50), http_latency_percentile(99));
+}
+
+void publish_http() {
+  mqtt_publish("http/served", http_served);
+  mqtt_publish("http/rejected", http_rejected);
+  mqtt_publish("http/failed", http_failed);
+  mqtt_publish("http/p50", http_latency_percentile(50));
+  mqtt_publish("http/p99", http_latency_percentile(99));
+}
+
+// GET /?r=<rendition>, the full frame by default
+static esp_err_t index_handler(httpd_req_t *req){
+    char query[32];
+    char name[16] = "full";
+    int r;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+        httpd_query_key_value(query, "r", name, sizeof(name));
+    r = rendition_find(name);
+    if (r < 0) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown rendition");
+        return ESP_FAIL;
+    }
+
+    if (!http_queue)
+        return index_send(req, r);
+
+    if (!http_job_queue(httpd_req_to_sockfd(req), HTTP_JOB_IMAGE, r)) {
+        http_rejected++;
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+    // the worker owns the connection now
+    return ESP_OK;
+}
+
+// GET /clip, the clip held after the last trigger
+static esp_err_t clip_handler(httpd_req_t *req){
+    if (!http_job_queue(httpd_req_to_sockfd(req), HTTP_JOB_CLIP, 0)) {
+        http_rejected++;
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, NULL, 0);
+    }
+    return ESP_OK;
+}
+
+
+// WebSocket push channel on /ws
+//
+// Subscribers get JPEG frames as binary messages and sensor values as
+// "topic value" text messages. Every subscriber has its own sender task,
+// so a slow client only delays itself. Frames are latest-frame-wins: a
+// client that is still busy skips straight to the newest frame, the full
+// rendition of the shared capture, which the loop task holds a reference
+// to until the next one replaces it. Sensor values go through a small per
+// client queue that drops the oldest entry.
+// Clients are not authenticated, so only LED, display, rendition, encoder
+// and clip trigger commands are accepted. They run on the loop task like
+// MQTT commands.
+#define WS_MAX_CLIENTS 3
+#define WS_QUEUE_LEN 8
+#define WS_MSG_LEN 48
+#define WS_SEND_TIMEOUT 2 // seconds
+#define WS_COMMANDS 4     // commands waiting for the loop task
+
+typedef struct {
+  int fd;  // -1 if unused
+  int sending;   // fd the sender task is writing to, -1 if idle
+  bool closing;  // closed while sending, the sender task closes it
+  bool frames;
+  bool telemetry;
+  uint32_t last_frame;
+  char queue[WS_QUEUE_LEN][WS_MSG_LEN];
+  uint8_t queue_head;
+  uint8_t queue_len;
+  TaskHandle_t task;
+} ws_client_t;
+
+ws_client_t ws_clients[WS_MAX_CLIENTS];
+rendition_set_t *ws_latest = NULL;  // written by the loop task only
+uint32_t ws_latest_id = 0;
+SemaphoreHandle_t ws_lock = NULL;
+QueueHandle_t ws_commands = NULL;
+uint32_t ws_frame_counter = 0;
+unsigned int ws_frame_interval = 100; // ms between pushed frames
+unsigned long ws_last_frame = 0;
+
+// statistics
+uint32_t ws_frames_sent = 0;
+uint32_t ws_frames_skipped = 0;
+uint32_t ws_messages_dropped = 0;
+uint32_t ws_latency_sum = 0;
+uint32_t ws_commands_rejected = 0;
+
+// true if a sender task is still writing to fd and will close it
+static bool ws_remove(int fd) {
+  bool deferred = false;
+
+  if (!ws_lock)
+    return false;
+  xSemaphoreTake(ws_lock, portMAX_DELAY);
+  for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+    ws_client_t *c = &ws_clients[i];
+    if (c->fd != fd)
+      continue;
+    c->fd = -1;
+    if (c->sending == fd) {
+      // make the send fail now instead of after its timeout
+      shutdown(fd, SHUT_RDWR);
+      c->closing = true;
+      deferred = true;
+    }
+    Log.notice(F("WebSocket client %d gone"), fd);
+  }
+  xSemaphoreGive(ws_lock);
+  return deferred;
+}
+
+static void httpd_close_cb(httpd_handle_t hd, int fd) {
+  bool deferred = ws_remove(fd);
+  if (http_cancel(fd))
+    deferred = true;
+  if (!deferred)
+    close(fd);
+}
+
+static bool ws_send(int fd, httpd_ws_type_t type, const uint8_t *data, size_t len) {
+  httpd_ws_frame_t frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.final = true;
+  frame.type = type;
+  frame.payload = (uint8_t *)data;
+  frame.len = len;
+  if (httpd_ws_send_frame_async(camera_httpd, fd, &frame) != ESP_OK) {
+    Log.error(F("WebSocket send to %d failed"), fd);
+    httpd_sess_trigger_close(camera_httpd, fd);
+    return false;
+  }
+  return true;
+}
+
+static void ws_sender_task(void *arg) {
+  ws_client_t *c = (ws_client_t *)arg;
+  char msg[WS_MSG_LEN];
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    for (;;) {
+      int fd;
+      rendition_set_t *f = NULL;
+      bool have_msg = false;
+
+      xSemaphoreTake(ws_lock, portMAX_DELAY);
+      fd = c->sending = c->fd;
+      if (fd >= 0 && c->queue_len) {
+        strncpy(msg, c->queue[c->queue_head], WS_MSG_LEN);
+        c->queue_head = (c->queue_head + 1) % WS_QUEUE_LEN;
+        c->queue_len--;
+        have_msg = true;
+      } else if (fd >= 0 && c->frames && ws_latest && ws_latest_id != c->last_frame) {
+        f = ws_latest;
+        rendition_hold(f);
+        if (c->last_frame)
+          ws_frames_skipped += ws_latest_id - c->last_frame - 1;
+        c->last_frame = ws_latest_id;
+      }
+      xSemaphoreGive(ws_lock);
+
+      bool ok = false;
+      if (have_msg)
+        ok = ws_send(fd, HTTPD_WS_TYPE_TEXT, (const uint8_t *)msg, strlen(msg));
+      else if (f)
+        ok = ws_send(fd, HTTPD_WS_TYPE_BINARY, f->buf[RENDITION_FULL], f->len[RENDITION_FULL]);
+
+      xSemaphoreTake(ws_lock, portMAX_DELAY);
+      c->sending = -1;
+      if (c->closing) {
+        // the server let go of the session while we were sending
+        close(fd);
+        c->closing = false;
+      }
+      if (f && ok) {
+        ws_frames_sent++;
+        ws_latency_sum += millis() - f->captured;
+      }
+      xSemaphoreGive(ws_lock);
+      if (f)
+        rendition_release(f);
+      if (!have_msg && !f)
+        break;
+    }
+  }
+}
+
+static void ws_notify(bool frames) {
+  for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+    if (ws_clients[i].fd >= 0 && (ws_clients[i].frames || !frames))
+      xTaskNotifyGive(ws_clients[i].task);
+  }
+}
+
+// queue a sensor value for every telemetry subscriber
+void ws_push_telemetry(const char *topic, const char *value) {
+  if (!ws_lock)
+    return;
+  xSemaphoreTake(ws_lock, portMAX_DELAY);
+  for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+    ws_client_t *c = &ws_clients[i];
+    if (c->fd < 0 || !c->telemetry)
+      continue;
+    if (c->queue_len == WS_QUEUE_LEN) {
+      c->queue_head = (c->queue_head + 1) % WS_QUEUE_LEN;
+      c->queue_len--;
+      ws_messages_dropped++;
+    }
+    snprintf(c->queue[(c->queue_head + c->queue_len) % WS_QUEUE_LEN],
+      WS_MSG_LEN, "%s %s", topic, value);
+    c->queue_len++;
+  }
+  xSemaphoreGive(ws_lock);
+  ws_notify(false);
+}
+
+static bool ws_frame_subscribers() {
+  for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+    if (ws_clients[i].fd >= 0 && ws_clients[i].frames)
+      return true;
+  }
+  return false;
+}
+
+// let go of the last frame once nobody watches frames any more
+static void ws_release_frames() {
+  rendition_set_t *f = ws_latest;
+  if (!f)
+    return;
+
+  xSemaphoreTake(ws_lock, portMAX_DELAY);
+  ws_latest = NULL;
+  xSemaphoreGive(ws_lock);
+  rendition_release(f);
+}
+
+// only harmless commands from unauthenticated clients: display, capture
+// settings and clip triggers
+static bool ws_command_allowed(const char *cmd) {
+  return !strncmp(cmd, "led ", 4) || !strncmp(cmd, "display ", 8) ||
+    !strncmp(cmd, "rendition ", 10) || !strncmp(cmd, "encoder ", 8) ||
+    !strcmp(cmd, "clip trigger");
+}
+
+// run commands from WebSocket clients on the loop task
+static void ws_run_commands() {
+  char cmd[WS_MSG_LEN];
+  while (xQueueReceive(ws_commands, cmd, 0) == pdTRUE)
+    mqtt_callback("ws", (byte *)cmd, strlen(cmd));
+}
+
+// hand the current frame to the sender tasks
+void loop_websocket() {
+  if (!ws_lock)
+    return;
+  ws_run_commands();
+  if (!camera_found)
+    return;
+  if (!ws_frame_subscribers()) {
+    ws_release_frames();
+    return;
+  }
+  if (millis() - ws_last_frame < ws_frame_interval)
+    return;
+  ws_last_frame = millis();
+
+  rendition_set_t *set = rendition_get();
+  if (!set)
+    return;
+  if (set == ws_latest || !set->len[RENDITION_FULL]) {
+    // still the frame pushed last time, or the full frame failed to encode
+    rendition_release(set);
+    return;
+  }
+
+  rendition_set_t *old;
+  xSemaphoreTake(ws_lock, portMAX_DELAY);
+  old = ws_latest;
+  ws_latest = set;
+  ws_latest_id = ++ws_frame_counter;
+  xSemaphoreGive(ws_lock);
+  if (old)
+    rendition_release(old);
+  ws_notify(true);
+}
+
+static esp_err_t ws_handler(httpd_req_t *req) {
+  int fd = httpd_req_to_sockfd(req);
+
+  if (req->method == HTTP_GET) {
+    // handshake done, register the new client
+    int i;
+    xSemaphoreTake(ws_lock, portMAX_DELAY);
+    for (i = 0; i < WS_MAX_CLIENTS; i++) {
+      if (ws_clients[i].fd < 0) {
+        ws_clients[i].fd = fd;
+        ws_clients[i].frames = false;
+        ws_clients[i].telemetry = false;
+        ws_clients[i].last_frame = 0;
+        ws_clients[i].queue_len = 0;
+        break;
+      }
+    }
+    xSemaphoreGive(ws_lock);
+    if (i == WS_MAX_CLIENTS) {
+      Log.error(F("Too many WebSocket clients"));
+      return ESP_FAIL;
+    }
+    Log.notice(F("WebSocket client %d connected"), fd);
+    struct timeval tv = { WS_SEND_TIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return ESP_OK;
+  }
+
+  uint8_t buf[128];
+  httpd_ws_frame_t frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.payload = buf;
+  if (httpd_ws_recv_frame(req, &frame, sizeof(buf) - 1) != ESP_OK)
+    return ESP_FAIL;
+  if (frame.type != HTTPD_WS_TYPE_TEXT)
+    return ESP_OK;
+  buf[frame.len] = 0;
+
+  // subscribe|unsubscribe frames|telemetry, everything else is a command
+  char *arg = strchr((char *)buf, ' ');
+  bool sub = !strncmp((char *)buf, "subscribe ", 10);
+  if (arg && (sub || !strncmp((char *)buf, "unsubscribe ", 12))) {
+    arg++;
+    xSemaphoreTake(ws_lock, portMAX_DELAY);
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+      if (ws_clients[i].fd != fd)
+        continue;
+      if (!strcmp(arg, "frames"))
+        ws_clients[i].frames = sub;
+      if (!strcmp(arg, "telemetry"))
+        ws_clients[i].telemetry = sub;
+    }
+    xSemaphoreGive(ws_lock);
+  } else if (frame.len < WS_MSG_LEN && ws_command_allowed((char *)buf)) {
+    if (xQueueSend(ws_commands, buf, 0) != pdTRUE)
+      ws_commands_rejected++;
+  } else {
+    ws_commands_rejected++;
+    Log.error(F("WebSocket command from %d rejected"), fd);
+  }
+  return ESP_OK;
+}
+
+void setup_websocket() {
+  ws_lock = xSemaphoreCreateMutex();
+  ws_commands = xQueueCreate(WS_COMMANDS, WS_MSG_LEN);
+  for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+    ws_clients[i].fd = -1;
+    ws_clients[i].sending = -1;
+    ws_clients[i].closing = false;
+    xTaskCreate(ws_sender_task, "ws_sender", 3072, &ws_clients[i], 4, &ws_clients[i].task);
+  }
+}
+
+void log_websocket() {
+  Log.notice(F("WebSocket: %d frames sent, %d skipped, %d messages dropped, %d commands rejected"),
+    ws_frames_sent, ws_frames_skipped, ws_messages_dropped, ws_commands_rejected);
+  if (ws_frames_sent)
+    Log.notice(F("WebSocket latency %d ms"), ws_latency_sum / ws_frames_sent);
+  if (http_frames)
+    Log.notice(F("HTTP polling latency %d ms"), http_latency_sum / http_frames);
+}
+
+void publish_websocket() {
+  mqtt_publish("ws/sent", ws_frames_sent);
+  mqtt_publish("ws/skipped", ws_frames_skipped);
+  mqtt_publish("ws/dropped", ws_messages_dropped);
+  mqtt_publish("ws/rejected", ws_commands_rejected);
+  if (ws_frames_sent)
+    mqtt_publish("ws/latency", ws_latency_sum / ws_frames_sent);
+  if (http_frames)
+    mqtt_publish("http/latency", http_latency_sum / http_frames);
+}
+
+// RTSP server for network video recorders
+//
+// One client at a time, RTP/JPEG over UDP or interleaved in the RTSP
+// connection. Frames are the full rendition of the shared capture, so a
+// stream running next to HTTP or WebSocket clients costs no extra capture
+// or encode. Over TCP header and payload of a packet go out together in
+// one writev, without copying the payload.
+#define RTSP_PORT 554
+#define RTSP_MTU 1400
+#define RTSP_REQUEST_LEN 1024
+#define RTSP_TIMEOUT 60 // s without a request before the session is dropped
+#define RTSP_WRITE_RETRIES 100  // 1 ms waits for a full send buffer per packet
+
+WiFiServer rtsp_server(RTSP_PORT);
+WiFiClient rtsp_client;
+WiFiUDP rtp_udp;
+rtp_session_t rtp_session;
+char rtsp_request[RTSP_REQUEST_LEN + 1];
+size_t rtsp_request_len = 0;
+size_t rtsp_skip = 0;           // interleaved data from the client to ignore
+uint32_t rtsp_session_id = 0;
+bool rtsp_playing = false;
+uint16_t rtp_port = 0;
+unsigned int rtsp_frame_interval = 100; // ms
+unsigned long rtsp_last_frame = 0;
+unsigned long rtsp_last_request = 0;
+uint32_t rtsp_frame_id = 0;     // rendition frame sent last
+
+// statistics
+uint32_t rtsp_frames = 0;
+uint32_t rtsp_packets = 0;
+uint32_t rtsp_bytes = 0;
+uint32_t rtsp_packetize_us = 0;
+
+static bool rtp_send_udp(void *arg, const uint8_t *header, size_t header_len,
+  const uint8_t *payload, size_t payload_len) {
+  if (!rtp_udp.beginPacket(rtsp_client.remoteIP(), rtp_port))
+    return false;
+  rtp_udp.write(header, header_len);
+  rtp_udp.write(payload, payload_len);
+  rtsp_bytes += header_len + payload_len;
+  return rtp_udp.endPacket();
+}
+
+// header and payload in one writev, so a packet never waits for the ACK of
+// its own header; lwip may take only part of it when the send buffer fills
+static bool rtp_send_tcp(void *arg, const uint8_t *header, size_t header_len,
+  const uint8_t *payload, size_t payload_len) {
+  struct iovec iov[2] = { { (void *)header, header_len }, { (void *)payload, payload_len } };
+  struct iovec *v = iov;
+  int count = 2, retries = RTSP_WRITE_RETRIES;
+
+  rtsp_bytes += header_len + payload_len;
+  while (count) {
+    ssize_t n = lwip_writev(rtsp_client.fd(), v, count);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && retries-- > 0) {
+      delay(1);
+      continue;
+    }
+    if (n <= 0)
+      return false;
+    while (count && (size_t)n >= v->iov_len) {
+      n -= v->iov_len;
+      v++;
+      count--;
+    }
+    if (count) {
+      v->iov_base = (uint8_t *)v->iov_base + n;
+      v->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+static void rtsp_stop() {
+  if (rtsp_client.connected())
+    rtsp_client.stop();
+  rtsp_playing = false;
+  rtsp_request_len = 0;
+  rtsp_skip = 0;
+  Log.notice(F("RTSP session ended"));
+}
+
+static void rtsp_reply(const rtsp_request_t *r, const char *status, const char *headers) {
+  char buf[384];
+  snprintf(buf, sizeof(buf), "RTSP/1.0 %s\r\nCSeq: %d\r\n%s\r\n", status, r->cseq, headers);
+  rtsp_client.print(buf);
+}
+
+static void rtsp_handle(const rtsp_request_t *r) {
+  char headers[256];
+  String ip = WiFi.localIP().toString();
+
+  switch (r->method) {
+    case RTSP_OPTIONS:
+      rtsp_reply(r, "200 OK", "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN\r\n");
+      break;
+    case RTSP_DESCRIBE: {
+      char sdp[200];
+      int n = snprintf(sdp, sizeof(sdp),
+        "v=0\r\no=- %lu 1 IN IP4 %s\r\ns=%s\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\n"
+        "m=video 0 RTP/AVP 26\r\na=control:track1\r\n",
+        (unsigned long)rtp_session.ssrc, ip.c_str(), Smyname.c_str());
+      snprintf(headers, sizeof(headers),
+        "Content-Base: rtsp://%s/\r\nContent-Type: application/sdp\r\nContent-Length: %d\r\n",
+        ip.c_str(), n);
+      rtsp_reply(r, "200 OK", headers);
+      rtsp_client.print(sdp);
+      break;
+    }
+    case RTSP_SETUP:
+      rtsp_session_id = esp_random();
+      if (r->tcp) {
+        rtp_session.interleaved = r->interleaved[0];
+        snprintf(headers, sizeof(headers),
+          "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\nSession: %08lx;timeout=%d\r\n",
+          r->interleaved[0], r->interleaved[1], (unsigned long)rtsp_session_id, RTSP_TIMEOUT);
+      } else if (r->client_port[0]) {
+        rtp_session.interleaved = -1;
+        rtp_port = r->client_port[0];
+        snprintf(headers, sizeof(headers),
+          "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d\r\nSession: %08lx;timeout=%d\r\n",
+          r->client_port[0], r->client_port[1], RTSP_PORT + 1000, RTSP_PORT + 1001,
+          (unsigned long)rtsp_session_id, RTSP_TIMEOUT);
+      } else {
+        rtsp_reply(r, "461 Unsupported Transport", "");
+        break;
+      }
+      rtsp_reply(r, "200 OK", headers);
+      break;
+    case RTSP_PLAY:
+      snprintf(headers, sizeof(headers), "Session: %08lx\r\nRange: npt=0.000-\r\n",
+        (unsigned long)rtsp_session_id);
+      rtsp_reply(r, "200 OK", headers);
+      rtsp_playing = true;
+      Log.notice(F("RTSP playing over %s"), rtp_session.interleaved < 0 ? "UDP" : "TCP");
+      break;
+    case RTSP_TEARDOWN:
+      snprintf(headers, sizeof(headers), "Session: %08lx\r\n", (unsigned long)rtsp_session_id);
+      rtsp_reply(r, "200 OK", headers);
+      rtsp_stop();
+      break;
+    default:
+      rtsp_reply(r, "501 Not Implemented", "");
+      break;
+  }
+}
+
+// read whatever the client sent, handle complete requests
+static void rtsp_read() {
+  if (rtsp_client.available())
+    rtsp_last_request = millis();
+  while (rtsp_client.available()) {
+    int c = rtsp_client.read();
+    if (c < 0)
+      break;
+    if (rtsp_skip) {
+      rtsp_skip--;
+      continue;
+    }
+    if (rtsp_request_len == 0 && c == '$') {
+      // interleaved RTCP from the client, channel and length follow
+      uint8_t h[3];
+      if (rtsp_client.read(h, 3) == 3)
+        rtsp_skip = (h[1] << 8) | h[2];
+      continue;
+    }
+    if (rtsp_request_len == RTSP_REQUEST_LEN) {
+      Log.error(F("RTSP request too long"));
+      rtsp_stop();
+      return;
+    }
+    rtsp_request[rtsp_request_len++] = c;
+    if (rtsp_request_len >= 4 &&
+        !memcmp(rtsp_request + rtsp_request_len - 4, "\r\n\r\n", 4)) {
+      rtsp_request_t r;
+      rtsp_request[rtsp_request_len] = 0;
+      if (rtsp_parse_request(rtsp_request, rtsp_request_len, &r))
+        rtsp_handle(&r);
+      rtsp_request_len = 0;
+      if (!rtsp_client.connected())
+        return;
+    }
+  }
+}
+
+static void rtsp_send_frame() {
+  rendition_set_t *set = rendition_get();
+  if (!set)
+    return;
+  if (set->frame_id == rtsp_frame_id || !set->len[RENDITION_FULL]) {
+    rendition_release(set);
+    return;
+  }
+  rtsp_frame_id = set->frame_id;
+
+  rtp_jpeg_frame_t frame;
+  if (rtp_jpeg_parse(set->buf[RENDITION_FULL], set->len[RENDITION_FULL], &frame)) {
+    unsigned long start = micros();
+    int packets = rtp_jpeg_send(&rtp_session, &frame,
+      rtp_timestamp(set->captured / 1000, (set->captured % 1000) * 1000), RTSP_MTU,
+      rtp_session.interleaved < 0 ? rtp_send_udp : rtp_send_tcp, NULL);
+    rtsp_packetize_us += micros() - start;
+    if (packets > 0) {
+      rtsp_frames++;
+      rtsp_packets += packets;
+    } else if (rtp_session.interleaved >= 0) {
+      rtsp_stop();
+    }
+  } else {
+    Log.error(F("Frame is no baseline JPEG RTP can carry"));
+  }
+  rendition_release(set);
+}
+
+void loop_rtsp() {
+  if (!rtsp_client.connected()) {
+    if (rtsp_playing)
+      rtsp_stop();
+    rtsp_client = rtsp_server.available();
+    if (!rtsp_client)
+      return;
+    Log.notice(F("RTSP client %s"), rtsp_client.remoteIP().toString().c_str());
+    // interleaved frames end in a short packet, do not let Nagle hold it back
+    rtsp_client.setNoDelay(true);
+    rtsp_last_request = millis();
+  }
+
+  rtsp_read();
+  if (!rtsp_client.connected())
+    return;
+
+  // covers RTSP keepalives as well as interleaved RTCP reports
+  if (millis() - rtsp_last_request > RTSP_TIMEOUT * 1000UL) {
+    rtsp_stop();
+    return;
+  }
+
+  if (camera_found && rtsp_playing && millis() - rtsp_last_frame >= rtsp_frame_interval) {
+    rtsp_last_frame = millis();
+    rtsp_send_frame();
+  }
+}
+
+void setup_rtsp() {
+  rtp_session.seq = 0;
+  rtp_session.ssrc = esp_random();
+  rtp_session.interleaved = -1;
+  rtp_udp.begin(RTSP_PORT + 1000);
+  rtsp_server.begin();
+  Log.notice(F("RTSP server on port %d started"), RTSP_PORT);
+}
+
+void log_rtsp() {
+  Log.notice(F("RTSP: %d frames, %d packets, %d bytes"), rtsp_frames, rtsp_packets, rtsp_bytes);
+  if (rtsp_frames)
+    Log.notice(F("RTSP: %d us to packetize and send a frame"), rtsp_packetize_us / rtsp_frames);
+}
+
+void publish_rtsp() {
+  mqtt_publish("rtsp/frames", rtsp_frames);
+  mqtt_publish("rtsp/bytes", rtsp_bytes);
+  if (rtsp_frames)
+    mqtt_publish("rtsp/frametime", rtsp_packetize_us / rtsp_frames);
+}
+
+// Soak testing
+//
+// Heap tracking runs all the time: every soak_interval seconds a sample of
+// the internal heap and of loop and HTTP latency goes into a ring, and the
+// trend is the least squares slope over the ring, per hour. A steady loss
+// of free heap or of the largest free block shows up there long before
+// captures start failing.
+//
+// "soak start <minutes>" puts synthetic load on top of normal operation:
+// captures through the same rendition path as "/", and unless switched off
+// with "soak rate 0" and "soak disconnect 0" a mix of MQTT commands fed
+// through mqtt_callback and a broker disconnect every soak_disconnect ms.
+// tools/soak.cpp drives the whole run from the host instead: HTTP load,
+// the same command mix through a local broker, broker disconnects by
+// relaying the MQTT connection, and it collects the samples from /diag and
+// compares the trend between builds.
+#define SOAK_SAMPLES 48
+
+typedef struct {
+  uint32_t uptime;    // s
+  uint32_t free;      // internal heap
+  uint32_t min_free;
+  uint32_t largest;   // largest free block
+  uint32_t blocks;    // allocated blocks
+  uint16_t loop_max;  // ms, slowest loop iteration since the last sample
+  uint16_t http_p95;  // ms
+} soak_sample_t;
+
+typedef struct {
+  const char *command;
+  uint8_t weight;
+} soak_command_t;
+
+// read-only or harmless commands, weighted roughly like a dashboard polls,
+// tools/soak.cpp sends the same mix
+const soak_command_t soak_commands[] = {
+  { "telemetry", 10 },
+  { "loop", 10 },
+  { "pool", 10 },
+  { "outbox", 10 },
+  { "http", 5 },
+  { "ws", 5 },
+  { "rtsp", 5 },
+  { "rendition", 5 },
+  { "encoder", 5 },
+  { "clip", 5 },
+  { "power", 5 },
+  { "config", 5 },
+  { "display temperature", 5 },
+  { "display soak test in progress", 5 },
+};
+#define SOAK_COMMAND_COUNT (sizeof(soak_commands) / sizeof(soak_commands[0]))
+
+soak_sample_t soak_samples[SOAK_SAMPLES];
+unsigned int soak_sample_count = 0;
+unsigned int soak_interval = 60;         // s between samples
+unsigned int soak_rate = 100;            // ms between commands, 0 for none
+unsigned int soak_capture = 500;         // ms between captures
+unsigned int soak_disconnect = 60000;    // ms between broker disconnects
+unsigned long soak_last_sample = 0;
+unsigned long soak_last_loop = 0;
+unsigned long soak_last_command = 0;
+unsigned long soak_last_capture = 0;
+unsigned long soak_last_disconnect = 0;
+unsigned long soak_until = 0;
+uint32_t soak_loop_max = 0;
+bool soak_running = false;
+
+// statistics
+uint32_t soak_commands_sent = 0;
+uint32_t soak_captures = 0;
+uint32_t soak_capture_failures = 0;
+uint32_t soak_disconnects = 0;
+
+typedef struct {
+  float free;      // B/h
+  float largest;   // B/h
+  float blocks;    // blocks/h
+  float loop_max;  // ms/h
+} soak_trend_t;
+
+static soak_sample_t *soak_sample_at(unsigned int i) {
+  unsigned int first = soak_sample_count > SOAK_SAMPLES ? soak_sample_count - SOAK_SAMPLES : 0;
+  return &soak_samples[(first + i) % SOAK_SAMPLES];
+}
+
+static unsigned int soak_samples_kept() {
+  return soak_sample_count < SOAK_SAMPLES ? soak_sample_count : SOAK_SAMPLES;
+}
+
+// least squares slope of every field over the samples in the ring
+bool soak_trend(soak_trend_t *t) {
+  unsigned int n = soak_samples_kept();
+  if (n < 3)
+    return false;
+
+  // relative to the first sample, keeps the floats small
+  soak_sample_t *s0 = soak_sample_at(0);
+  float sx = 0, sxx = 0, sf = 0, sl = 0, sb = 0, sm = 0, sxf = 0, sxl = 0, sxb = 0, sxm = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    soak_sample_t *s = soak_sample_at(i);
+    float x = (s->uptime - s0->uptime) / 3600.0;
+    float f = (float)s->free - s0->free;
+    float l = (float)s->largest - s0->largest;
+    float b = (float)s->blocks - s0->blocks;
+    float m = (float)s->loop_max - s0->loop_max;
+    sx += x; sxx += x * x;
+    sf += f; sl += l; sb += b; sm += m;
+    sxf += x * f; sxl += x * l; sxb += x * b; sxm += x * m;
+  }
+  float d = n * sxx - sx * sx;
+  if (d == 0)
+    return false;
+  t->free = (n * sxf - sx * sf) / d;
+  t->largest = (n * sxl - sx * sl) / d;
+  t->blocks = (n * sxb - sx * sb) / d;
+  t->loop_max = (n * sxm - sx * sm) / d;
+  return true;
+}
+
+void soak_sample() {
+  multi_heap_info_t info;
+  soak_sample_t *s = &soak_samples[soak_sample_count % SOAK_SAMPLES];
+
+  heap_caps_get_info(&info, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  s->uptime = millis() / 1000;
+  s->free = info.total_free_bytes;
+  s->min_free = info.minimum_free_bytes;
+  s->largest = info.largest_free_block;
+  s->blocks = info.allocated_blocks;
+  s->loop_max = soak_loop_max > 0xffff ? 0xffff : soak_loop_max;
+  s->http_p95 = http_latency_percentile(95);
+  soak_sample_count++;
+  soak_loop_max = 0;
+
+  if (soak_running)
+    Log.notice(F("Soak: %d B free, largest %d B, %d blocks, loop max %d ms"),
+      s->free, s->largest, s->blocks, s->loop_max);
+}
+
+static void soak_send_command() {
+  unsigned int total = 0;
+  for (unsigned int i = 0; i < SOAK_COMMAND_COUNT; i++)
+    total += soak_commands[i].weight;
+
+  unsigned int pick = random(total);
+  unsigned int i = 0;
+  while (pick >= soak_commands[i].weight) {
+    pick -= soak_commands[i].weight;
+    i++;
+  }
+
+  char payload[40];
+  strncpy(payload, soak_commands[i].command, sizeof(payload) - 1);
+  payload[sizeof(payload) - 1] = 0;
+  mqtt_callback((char *)Smyname.c_str(), (byte *)payload, strlen(payload));
+  soak_commands_sent++;
+}
+
+static void soak_capture_frame() {
+  rendition_set_t *set = rendition_get();
+  if (!set) {
+    soak_capture_failures++;
+    return;
+  }
+  rendition_release(set);
+  soak_captures++;
+}
+
+void log_soak() {
+  soak_trend_t t;
+
+  Log.notice(F("Soak %T: %d commands, %d captures (%d failed), %d disconnects"),
+    soak_running, soak_commands_sent, soak_captures, soak_capture_failures, soak_disconnects);
+  if (!soak_sample_count)
+    return;
+  soak_sample_t *s = soak_sample_at(soak_samples_kept() - 1);
+  Log.notice(F("Heap: %d B free, %d B minimum, largest %d B, %d blocks"),
+    s->free, s->min_free, s->largest, s->blocks);
+  if (soak_trend(&t))
+    Log.notice(F("Trend per hour: free %F B, largest %F B, blocks %F, loop max %F ms"),
+      t.free, t.largest, t.blocks, t.loop_max);
+}
+
+void publish_soak() {
+  soak_trend_t t;
+
+  mqtt_publish("soak/commands", soak_commands_sent);
+  mqtt_publish("soak/captures", soak_captures);
+  mqtt_publish("soak/capturefailures", soak_capture_failures);
+  mqtt_publish("soak/disconnects", soak_disconnects);
+  if (soak_sample_count) {
+    soak_sample_t *s = soak_sample_at(soak_samples_kept() - 1);
+    mqtt_publish("soak/free", s->free);
+    mqtt_publish("soak/minfree", s->min_free);
+    mqtt_publish("soak/largest", s->largest);
+    mqtt_publish("soak/blocks", s->blocks);
+  }
+  if (soak_trend(&t)) {
+    mqtt_publish("soak/trend/free", t.free);
+    mqtt_publish("soak/trend/largest", t.largest);
+    mqtt_publish("soak/trend/blocks", t.blocks);
+    mqtt_publish("soak/trend/loop", t.loop_max);
+  }
+}
+
+static void soak_stop() {
+  soak_running = false;
+  Log.notice(F("Soak finished"));
+  log_soak();
+  publish_soak();
+}
+
+void loop_soak() {
+  unsigned long t = millis();
+
+  if (soak_last_loop && t - soak_last_loop > soak_loop_max)
+    soak_loop_max = t - soak_last_loop;
+  soak_last_loop = t;
+  if (t - soak_last_sample >= soak_interval * 1000UL) {
+    soak_last_sample = t;
+    soak_sample();
+  }
+
+  if (!soak_running)
+    return;
+  if ((long)(t - soak_until) >= 0) {
+    soak_stop();
+    return;
+  }
+  if (soak_rate && t - soak_last_command >= soak_rate) {
+    soak_last_command = t;
+    soak_send_command();
+  }
+  if (camera_found && rendition_capture && t - soak_last_capture >= soak_capture) {
+    soak_last_capture = t;
+    soak_capture_frame();
+  }
+  if (soak_disconnect && t - soak_last_disconnect >= soak_disconnect) {
+    soak_last_disconnect = t;
+    if (client.connected()) {
+      client.disconnect();
+      soak_disconnects++;
+    }
+  }
+}
+
+// soak [start <minutes>|stop|reset|interval <s>|rate <ms>|disconnect <ms>]
+void command_soak(String *in, unsigned int wordcounter) {
+  if (wordcounter == 0) {
+    log_soak();
+    publish_soak();
+  } else if (in[1] == F("start")) {
+    unsigned long minutes = wordcounter == 2 && in[2].toInt() > 0 ? in[2].toInt() : 60;
+    soak_until = millis() + minutes * 60000UL;
+    soak_last_disconnect = millis();
+    soak_commands_sent = soak_captures = soak_capture_failures = soak_disconnects = 0;
+    soak_running = true;
+    Log.notice(F("Soak started for %d minutes"), minutes);
+  } else if (in[1] == F("stop")) {
+    if (soak_running)
+      soak_stop();
+  } else if (in[1] == F("reset")) {
+    soak_sample_count = 0;
+  } else if (wordcounter == 2 && in[2].toInt() >= 0) {
+    if (in[1] == F("interval") && in[2].toInt() > 0)
+      soak_interval = in[2].toInt();
+    else if (in[1] == F("rate"))
+      soak_rate = in[2].toInt();
+    else if (in[1] == F("disconnect"))
+      soak_disconnect = in[2].toInt();
+  }
+}
+
+// plain text diagnostics: loop sections, recent stalls and heap trend
+static esp_err_t diag_handler(httpd_req_t *req) {
+  char line[160];
+
+  httpd_resp_set_type(req, "text/plain");
+  snprintf(line, sizeof(line), "uptime %lu s, %lu iterations, %lu stalls over %u ms\n\n",
+    millis() / 1000, (unsigned long)profile_iterations,
+    (unsigned long)profile_stall_count, loop_budget);
+  httpd_resp_sendstr_chunk(req, line);
+
+  httpd_resp_sendstr_chunk(req, "section     max_us  histogram (count per bucket <2^n us)\n");
+  for (unsigned int i = 0; i < SECTION_COUNT; i++) {
+    int n = snprintf(line, sizeof(line), "%-10s %7lu ", section_names[i],
+      (unsigned long)profile_max_us[i]);
+    for (unsigned int b = 0; b < PROFILE_BUCKETS && n < (int)sizeof(line) - 12; b++)
+      n += snprintf(line + n, sizeof(line) - n, " %lu", (unsigned long)profile_histogram[i][b]);
+    snprintf(line + n, sizeof(line) - n, "\n");
+    httpd_resp_sendstr_chunk(req, line);
+  }
+
+  httpd_resp_sendstr_chunk(req, "\nrecent stalls: at_ms total_ms section section_ms\n");
+  uint32_t first = profile_stall_count > PROFILE_STALLS ? profile_stall_count - PROFILE_STALLS : 0;
+  for (uint32_t i = first; i < profile_stall_count; i++) {
+    loop_stall_t *st = &profile_stalls[i % PROFILE_STALLS];
+    snprintf(line, sizeof(line), "%lu %lu %s %lu\n", st->when,
+      (unsigned long)(st->total_us / 1000), section_names[st->section],
+      (unsigned long)(st->section_us / 1000));
+    httpd_resp_sendstr_chunk(req, line);
+  }
+
+  soak_trend_t t;
+  if (soak_trend(&t)) {
+    snprintf(line, sizeof(line), "\nheap trend per hour: free %.0f B, largest %.0f B, "
+      "blocks %.1f, loop max %.1f ms\n", t.free, t.largest, t.blocks, t.loop_max);
+    httpd_resp_sendstr_chunk(req, line);
+  }
+  httpd_resp_sendstr_chunk(req, "\nheap samples: uptime_s free min_free largest blocks loop_max_ms http_p95_ms\n");
+  for (unsigned int i = 0; i < soak_samples_kept(); i++) {
+    soak_sample_t *s = soak_sample_at(i);
+    snprintf(line, sizeof(line), "%lu %lu %lu %lu %lu %u %u\n", (unsigned long)s->uptime,
+      (unsigned long)s->free, (unsigned long)s->min_free, (unsigned long)s->largest,
+      (unsigned long)s->blocks, s->loop_max, s->http_p95);
+    httpd_resp_sendstr_chunk(req, line);
+  }
+  return httpd_resp_sendstr_chunk(req, NULL);
+}
 
 
 void setup_httpd(){
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.close_fn = httpd_close_cb;
+  // bound what slow or idle clients can hold on to; no LRU purge, it would
+  // close sessions handed to a worker or WebSocket sender under their feet
+  config.max_open_sockets = 6;
+  config.lru_purge_enable = false;
+  config.send_wait_timeout = HTTP_SEND_TIMEOUT;
+  config.recv_wait_timeout = HTTP_SEND_TIMEOUT;
 
   httpd_uri_t index_uri = {
         .uri       = "/",
@@ -820,23 +3655,369 @@ void setup_httpd(){
         .user_ctx  = NULL
   };
 
+  httpd_uri_t ws_uri = {
+        .uri       = "/ws",
+        .method    = HTTP_GET,
+        .handler   = ws_handler,
+        .user_ctx  = NULL,
+        .is_websocket = true
+  };
+
+  httpd_uri_t clip_uri = {
+        .uri       = "/clip",
+        .method    = HTTP_GET,
+        .handler   = clip_handler,
+        .user_ctx  = NULL
+  };
+
+  httpd_uri_t diag_uri = {
+        .uri       = "/diag",
+        .method    = HTTP_GET,
+        .handler   = diag_handler,
+        .user_ctx  = NULL
+  };
+
+  setup_websocket();
+  setup_renditions();
+  setup_http_workers();
   if (httpd_start(&camera_httpd, &config) == ESP_OK) {
     Log.notice(F("http server on port %d started"),config.server_port);
     httpd_register_uri_handler(camera_httpd, &index_uri);
+    httpd_register_uri_handler(camera_httpd, &ws_uri);
+    httpd_register_uri_handler(camera_httpd, &diag_uri);
+    httpd_register_uri_handler(camera_httpd, &clip_uri);
+  }
+
+}
+
+// Duty cycled low power mode
+//
+// With power.dutycycle set the device spends the time between transmissions
+// in deep sleep instead of running the loop. Every timer wake runs one cycle
+// of the state machine in duty_cycle.h and goes back to sleep. What has to
+// survive the sleep is kept in RTC memory: the sequencing state, access
+// point and IP configuration for a reconnect without scan and DHCP, the
+// sensor address, the telemetry encoder state and the queued messages.
+// The device only listens for commands briefly after publishing, so
+// "power dutycycle off" has to be sent as a retained message.
+#define DUTY_MAGIC 0x44757479
+#define DUTY_RTC_OUTBOX 16         // queued messages kept in RTC memory, more go to SPIFFS
+#define DUTY_FAST_TIMEOUT 2000     // ms for a connect with the stored parameters
+#define DUTY_PUBLISH_TIMEOUT 5000  // ms to empty the outbox
+#define DUTY_LISTEN 300            // ms to wait for commands after publishing
+#define DUTY_SNAPSHOT_SKIP 3       // frames to let exposure settle after power up
+
+typedef struct {
+  uint32_t magic;
+  bool active;
+  duty_cycle_t duty;
+  uint8_t bssid[6];
+  int32_t channel;
+  uint32_t ip, gateway, mask, dns;
+  uint8_t bme280_address;
+  telemetry_state_t telemetry;
+  uint32_t outbox_seq;
+  uint32_t outbox_sent_seq;
+  unsigned int outbox_len;
+  outbox_entry_t outbox[DUTY_RTC_OUTBOX];
+  // statistics
+  uint32_t awake_ms;      // last cycle
+  uint32_t awake_sum;     // all cycles
+  uint32_t fast_connects;
+  uint32_t full_connects;
+} duty_rtc_t;
+
+RTC_DATA_ATTR duty_rtc_t duty_rtc;
+
+bool duty_woken() {
+  return esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER &&
+    duty_rtc.magic == DUTY_MAGIC && duty_rtc.active;
+}
+
+static void duty_reset() {
+  memset(&duty_rtc, 0, sizeof(duty_rtc));
+  duty_init(&duty_rtc.duty, Idutysnapshot);
+  duty_rtc.magic = DUTY_MAGIC;
+}
+
+// put back what the last cycle left in RTC memory
+void duty_restore() {
+  // exact, unlike the reservation on SPIFFS, which would skip a block per wake
+  outbox_seq = duty_rtc.outbox_seq;
+  if (duty_rtc.outbox_sent_seq > outbox_sent_seq)
+    outbox_sent_seq = duty_rtc.outbox_sent_seq;
+  outbox_boot_seq = outbox_seq + 1;
+  for (unsigned int i = 0; i < duty_rtc.outbox_len && outbox_len < OUTBOX_LEN; i++)
+    outbox[(outbox_head + outbox_len++) % OUTBOX_LEN] = duty_rtc.outbox[i];
+
+  telemetry = duty_rtc.telemetry;
+  telemetry.channels = telemetry_channels;
+  Bdutycycle = true;
+  Log.notice(F("Duty cycle %d woken, %d messages queued"), duty_rtc.duty.cycle, outbox_len);
+}
+
+static void duty_setup_sensors() {
+  if (!duty_rtc.bme280_address) {
+    setup_i2c();
+    duty_rtc.bme280_address = bme280_address;
+    return;
+  }
+  // skip the bus scan, the sensor was there last time
+  Wire.begin(I2CSDA, I2CSCL);
+  bme280_found = bme280.begin(duty_rtc.bme280_address);
+  if (!bme280_found)
+    duty_rtc.bme280_address = 0;
+}
+
+static bool duty_connect_fast() {
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.config(IPAddress(duty_rtc.ip), IPAddress(duty_rtc.gateway),
+    IPAddress(duty_rtc.mask), IPAddress(duty_rtc.dns));
+  WiFi.begin(Sssid.c_str(), Spass.c_str(), duty_rtc.channel, duty_rtc.bssid);
+
+  unsigned long start = millis();
+  while (WiFi.status() != WL_CONNECTED) {
+    if (millis() - start > DUTY_FAST_TIMEOUT) {
+      Log.error(F("Fast connect to channel %d failed"), duty_rtc.channel);
+      WiFi.disconnect();
+      return false;
+    }
+    delay(10);
+  }
+  duty_rtc.fast_connects++;
+  return true;
+}
+
+static bool duty_connect_full() {
+  // back to DHCP, the stored address may be what broke the fast path
+  WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+  if (!setup_wifi())
+    return false;
+  memcpy(duty_rtc.bssid, WiFi.BSSID(), sizeof(duty_rtc.bssid));
+  duty_rtc.channel = WiFi.channel();
+  duty_rtc.ip = WiFi.localIP();
+  duty_rtc.gateway = WiFi.gatewayIP();
+  duty_rtc.mask = WiFi.subnetMask();
+  duty_rtc.dns = WiFi.dnsIP();
+  duty_rtc.full_connects++;
+  return true;
+}
+
+static bool duty_publish(const float *values, bool readings) {
+  unsigned long start = millis();
+
+  // older messages first, the outbox keeps the order; batches back to
+  // back, the radio is only on for this
+  while (outbox_pending() && client.connected() &&
+      millis() - start < DUTY_PUBLISH_TIMEOUT) {
+    if (!outbox_send_batch())
+      break;  // left for the next cycle
+    client.loop();
+  }
+  if (readings)
+    publish_telemetry(values, 0x07);
+  if (duty_rtc.duty.cycle > 1)
+    mqtt_publish("power/awake", duty_rtc.awake_ms);
+
+  start = millis();
+  while (millis() - start < DUTY_LISTEN) {
+    client.loop();
+    delay(10);
+  }
+  return client.connected() && !outbox_pending();
+}
+
+// undo the power down hold of duty_sleep, esp_camera_init fails while the
+// pin is latched high
+void duty_release_camera() {
+  gpio_hold_dis((gpio_num_t)PWDN_GPIO_NUM);
+  gpio_deep_sleep_hold_dis();
+}
+
+static bool duty_snapshot() {
+  char topic[60];
+
+  duty_release_camera();
+  setup_camera();
+  if (!camera_found)
+    return false;
+
+  camera_fb_t *fb = NULL;
+  for (int i = 0; i <= DUTY_SNAPSHOT_SKIP; i++) {
+    if (fb)
+      esp_camera_fb_return(fb);
+    fb = esp_camera_fb_get();
+    if (!fb) {
+      Log.error(F("Snapshot capture failed"));
+      return false;
+    }
+  }
+
+  snprintf(topic, sizeof(topic), "/%s/%s/snapshot", Ssite.c_str(), Sroom.c_str());
+  bool ok = client.beginPublish(topic, fb->len, false) &&
+    client.write(fb->buf, fb->len) == fb->len && client.endPublish();
+  if (!ok)
+    Log.error(F("Publishing snapshot failed"));
+  esp_camera_fb_return(fb);
+  return ok;
+}
+
+void duty_sleep() {
+  if (duty_rtc.magic != DUTY_MAGIC)
+    duty_reset();
+
+  // what does not fit into RTC memory waits on SPIFFS
+  if (outbox_len > DUTY_RTC_OUTBOX && !outbox_spill()) {
+    outbox_head = (outbox_head + outbox_len - DUTY_RTC_OUTBOX) % OUTBOX_LEN;
+    outbox_dropped += outbox_len - DUTY_RTC_OUTBOX;
+    outbox_len = DUTY_RTC_OUTBOX;
+  }
+  duty_rtc.outbox_len = outbox_len;
+  for (unsigned int i = 0; i < outbox_len; i++)
+    duty_rtc.outbox[i] = outbox[(outbox_head + i) % OUTBOX_LEN];
+  duty_rtc.outbox_seq = outbox_seq;
+  duty_rtc.outbox_sent_seq = outbox_sent_seq;
+  duty_rtc.telemetry = telemetry;
+  duty_rtc.active = true;
+
+  // millis() starts with the application, boot ROM and loader are not counted
+  duty_rtc.awake_ms = millis();
+  duty_rtc.awake_sum += duty_rtc.awake_ms;
+  uint64_t sleep_us = duty_sleep_us(&duty_rtc.duty, Idutyinterval, duty_rtc.awake_ms);
+  Log.notice(F("Awake %d ms, sleeping %d s"), duty_rtc.awake_ms, (uint32_t)(sleep_us / 1000000));
+
+  client.disconnect();
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  setled(0);
+
+  // keep the camera powered down while we sleep
+  pinMode(PWDN_GPIO_NUM, OUTPUT);
+  digitalWrite(PWDN_GPIO_NUM, HIGH);
+  gpio_hold_en((gpio_num_t)PWDN_GPIO_NUM);
+  gpio_deep_sleep_hold_en();
+
+  esp_sleep_enable_timer_wakeup(sleep_us);
+  esp_deep_sleep_start();
+}
+
+void duty_run() {
+  float values[CHANNEL_COUNT];
+  bool readings = false;
+  bool ok = true;
+
+  if (duty_rtc.magic != DUTY_MAGIC || !duty_rtc.active)
+    duty_reset();
+  duty_rtc.duty.snapshot_every = Idutysnapshot;
+  duty_running = true;
+
+  int action = duty_next(&duty_rtc.duty, DUTY_START);
+  while (action != DUTY_SLEEP) {
+    switch (action) {
+      case DUTY_READ_SENSORS:
+        // before the radio is on, it warms up the board
+        duty_setup_sensors();
+        readings = read_bme280(values);
+        ok = true;
+        break;
+      case DUTY_CONNECT_FAST:
+        ok = duty_connect_fast();
+        break;
+      case DUTY_CONNECT_FULL:
+        ok = duty_connect_full();
+        break;
+      case DUTY_CONNECT_MQTT:
+        setup_mqtt();
+        ok = mqtt_reconnect();
+        break;
+      case DUTY_PUBLISH:
+        ok = duty_publish(values, readings);
+        readings = false;
+        break;
+      case DUTY_SNAPSHOT:
+        ok = duty_snapshot();
+        break;
+    }
+    action = duty_next(&duty_rtc.duty, ok ? DUTY_OK : DUTY_FAIL);
   }
 
+  // not sent this time, queue them for the next cycle
+  if (readings)
+    publish_telemetry(values, 0x07);
+  duty_running = false;
+
+  if (Bdutycycle)
+    duty_sleep();
+  duty_rtc.active = false;
+  Log.notice(F("Duty cycle switched off, staying awake"));
+}
+
+void log_power() {
+  Log.notice(F("Duty cycle %T, every %d s, snapshot every %d cycles"),
+    Bdutycycle, Idutyinterval, Idutysnapshot);
+  if (duty_rtc.magic != DUTY_MAGIC || !duty_rtc.duty.cycle)
+    return;
+  Log.notice(F("%d cycles, awake %d ms last, %d ms average"), duty_rtc.duty.cycle,
+    duty_rtc.awake_ms, duty_rtc.awake_sum / duty_rtc.duty.cycle);
+  Log.notice(F("%d fast and %d full connects, %d cycles without broker"),
+    duty_rtc.fast_connects, duty_rtc.full_connects, duty_rtc.duty.failed_connects);
+}
+
+void publish_power() {
+  if (duty_rtc.magic != DUTY_MAGIC || !duty_rtc.duty.cycle)
+    return;
+  mqtt_publish("power/cycles", duty_rtc.duty.cycle);
+  mqtt_publish("power/awake_avg", duty_rtc.awake_sum / duty_rtc.duty.cycle);
+  mqtt_publish("power/fast", duty_rtc.fast_connects);
+  mqtt_publish("power/full", duty_rtc.full_connects);
+}
+
+// power dutycycle on|off
+// power interval <s>
+// power snapshot <n>
+void command_power(String *in, unsigned int wordcounter) {
+  if (wordcounter == 0) {
+    log_power();
+    publish_power();
+    return;
+  }
+  if (wordcounter != 2)
+    return;
+  if (in[1] == F("dutycycle")) {
+    Bdutycycle = (in[2] == F("on"));
+    if (!Bdutycycle)
+      duty_rtc.active = false;
+  } else if (in[1] == F("interval") && in[2].toInt() > 0) {
+    Idutyinterval = in[2].toInt();
+  } else if (in[1] == F("snapshot")) {
+    Idutysnapshot = in[2].toInt();
+  }
 }
 
 void setup() {
+  bool woken = duty_woken();
+
   setup_led();
-  setled(255,0,0);
-  delay(5000);
+  if (!woken) {
+    setled(255,0,0);
+    delay(5000);
+  }
   setup_serial();
   setup_logging();
   setup_readconfig();
   log_config();
+  setup_outbox();
+  setup_telemetry();
+  if (woken)
+    duty_restore();
+  if (Bdutycycle)
+    duty_run();  // only returns if the mode was switched off
   setup_i2c();
+  duty_release_camera();  // after any wake from duty_sleep
   setup_camera();
+  setup_pools();
+  setup_clip();
   // setup_esp32();
   setled(255, 128, 0);
   if (setup_wifi()) {
@@ -848,6 +4029,7 @@ void setup() {
     setled(2,1,0);
   }
   setup_httpd();
+  setup_rtsp();
 }
 
 void loop_publish_voltage(){
@@ -855,12 +4037,19 @@ void loop_publish_voltage(){
 }
 
 
+bool read_bme280(float *values) {
+  if (!bme280_found)
+    return false;
+  values[CHANNEL_TEMPERATURE] = bme280.readTemperature();
+  values[CHANNEL_AIRPRESSURE] = bme280.readPressure() / 100.0F;
+  values[CHANNEL_HUMIDITY] = bme280.readHumidity();
+  return true;
+}
+
 void loop_publish_bme280() {
-  if (bme280_found) {
-    mqtt_publish("temperature", bme280.readTemperature());
-    mqtt_publish("airpressure", bme280.readPressure() / 100.0F);
-    mqtt_publish("humidity", bme280.readHumidity());
-  }
+  float values[CHANNEL_COUNT];
+  if (read_bme280(values))
+    publish_telemetry(values, 0x07);
 }
 
 
@@ -898,6 +4087,8 @@ void lights_on(int dist) {
 
 void loop() {
   // put your main code here, to run repeatedly:
+  profile_begin();
+  loop_config();
   if (!client.connected()) {
     now = millis();
     if (now - lastReconnectAttempt > 5000) {
@@ -907,7 +4098,11 @@ void loop() {
       }
     }
   }
+  profile_mark(SECTION_RECONNECT);
   client.loop();
+  profile_mark(SECTION_MQTT);
+  loop_outbox();
+  profile_mark(SECTION_OUTBOX);
 
   // esp_bt_gap_start_discovery(ESP_BT_INQ_MODE_GENERAL_INQUIRY, 10, 10);
 
@@ -920,7 +4115,16 @@ void loop() {
 
     last_transmission = millis();
   }
+  profile_mark(SECTION_SENSORS);
 
+  loop_websocket();
+  profile_mark(SECTION_WEBSOCKET);
+  loop_rtsp();
+  profile_mark(SECTION_RTSP);
+  loop_clip();
+  profile_mark(SECTION_CLIP);
+  loop_soak();
+  profile_mark(SECTION_SOAK);
 
   if (u8x8_found && light_on && (((millis() - last_display) > (1000*30)) ||
       (display_what == DISPLAY_DISTANCE))) {
@@ -952,4 +4156,12 @@ void loop() {
 
     last_display = millis();
   }
+  profile_mark(SECTION_DISPLAY);
+  profile_report();
+  profile_mark(SECTION_REPORT);
+  profile_end();
+
+  // switched on at runtime, sleep once everything is delivered
+  if (Bdutycycle && !outbox_pending())
+    duty_sleep();
 }
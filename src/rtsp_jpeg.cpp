@@ -0,0 +1,232 @@
+#include "rtsp_jpeg.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+bool rtp_jpeg_parse(const uint8_t *jpg, size_t len, rtp_jpeg_frame_t *f) {
+  const uint8_t *tables[4] = { NULL, NULL, NULL, NULL };
+  uint8_t table_ids[2] = { 0, 1 };
+  size_t i = 2;
+
+  memset(f, 0, sizeof(*f));
+  if (len < 4 || jpg[0] != 0xff || jpg[1] != 0xd8)
+    return false;
+
+  while (i + 4 <= len) {
+    if (jpg[i] != 0xff)
+      return false;
+    uint8_t marker = jpg[i + 1];
+    if (marker == 0xff) {
+      i++;
+      continue;
+    }
+    size_t seglen = (jpg[i + 2] << 8) | jpg[i + 3];
+    const uint8_t *seg = jpg + i + 4;
+    if (seglen < 2 || i + 2 + seglen > len)
+      return false;
+
+    switch (marker) {
+      case 0xdb: // DQT, may hold several tables
+        for (size_t p = 0; p + 65 <= seglen - 2; p += 65) {
+          if ((seg[p] >> 4) != 0 || (seg[p] & 0x0f) > 3)
+            return false; // only 8 bit tables can be sent
+          tables[seg[p] & 0x0f] = seg + p + 1;
+        }
+        break;
+      case 0xc0: // SOF0, baseline
+        if (seglen < 8 + 3 * 3 || seg[5] != 3)
+          return false;
+        f->height = (seg[1] << 8) | seg[2];
+        f->width = (seg[3] << 8) | seg[4];
+        if (seg[7] == 0x21)
+          f->type = 0;
+        else if (seg[7] == 0x22)
+          f->type = 1;
+        else
+          return false;
+        // both chroma components must use the same sampling and table
+        if (seg[10] != 0x11 || seg[13] != 0x11 || seg[11] != seg[14])
+          return false;
+        table_ids[0] = seg[8] & 3;
+        table_ids[1] = seg[11] & 3;
+        break;
+      case 0xc1: case 0xc2: case 0xc3: case 0xc5: case 0xc6: case 0xc7:
+      case 0xc9: case 0xca: case 0xcb: case 0xcd: case 0xce: case 0xcf:
+        return false; // not baseline
+      case 0xdd: // DRI
+        f->restart_interval = (seg[0] << 8) | seg[1];
+        break;
+      case 0xda: // SOS, entropy coded data follows the header
+        f->scan = jpg + i + 2 + seglen;
+        f->scan_len = len - (f->scan - jpg);
+        // drop EOI and any padding after it
+        while (f->scan_len >= 2 &&
+               !(f->scan[f->scan_len - 2] == 0xff && f->scan[f->scan_len - 1] == 0xd9))
+          f->scan_len--;
+        if (f->scan_len >= 2)
+          f->scan_len -= 2;
+        f->qtables[0] = tables[table_ids[0]];
+        f->qtables[1] = tables[table_ids[1]];
+        if (f->restart_interval)
+          f->type |= 64;
+        return f->width && f->height && f->width <= 2040 && f->height <= 2040 &&
+          f->qtables[0] && f->qtables[1] && f->scan_len;
+    }
+    i += 2 + seglen;
+  }
+  return false;
+}
+
+int rtp_jpeg_send(rtp_session_t *s, const rtp_jpeg_frame_t *f, uint32_t timestamp,
+  size_t mtu, rtp_send_cb cb, void *arg) {
+  uint8_t h[RTP_JPEG_MAX_HEADER];
+  size_t offset = 0;
+  int packets = 0;
+
+  while (offset < f->scan_len) {
+    size_t n = 0;
+
+    if (s->interleaved >= 0) {
+      h[n++] = '$';
+      h[n++] = s->interleaved;
+      n += 2; // length, filled in below
+    }
+    size_t rtp_start = n;
+
+    h[n++] = 0x80;
+    h[n++] = RTP_PAYLOAD_JPEG;  // marker bit set on the last packet
+    h[n++] = s->seq >> 8;
+    h[n++] = s->seq & 0xff;
+    h[n++] = timestamp >> 24;
+    h[n++] = timestamp >> 16;
+    h[n++] = timestamp >> 8;
+    h[n++] = timestamp & 0xff;
+    h[n++] = s->ssrc >> 24;
+    h[n++] = s->ssrc >> 16;
+    h[n++] = s->ssrc >> 8;
+    h[n++] = s->ssrc & 0xff;
+
+    // main JPEG header, Q 255 means the tables are sent in band
+    h[n++] = 0;
+    h[n++] = offset >> 16;
+    h[n++] = offset >> 8;
+    h[n++] = offset & 0xff;
+    h[n++] = f->type;
+    h[n++] = 255;
+    h[n++] = f->width / 8;
+    h[n++] = f->height / 8;
+
+    if (f->type & 64) {
+      // packets do not end on restart intervals: F=1 L=1 count=0x3fff
+      h[n++] = f->restart_interval >> 8;
+      h[n++] = f->restart_interval & 0xff;
+      h[n++] = 0xff;
+      h[n++] = 0xff;
+    }
+    if (offset == 0) {
+      h[n++] = 0;   // MBZ
+      h[n++] = 0;   // precision, 8 bit tables
+      h[n++] = 0;
+      h[n++] = 128;
+      memcpy(h + n, f->qtables[0], 64);
+      memcpy(h + n + 64, f->qtables[1], 64);
+      n += 128;
+    }
+
+    size_t room = mtu - (n - rtp_start);
+    size_t len = f->scan_len - offset;
+    if (len > room)
+      len = room;
+    else
+      h[rtp_start + 1] |= 0x80;
+
+    if (s->interleaved >= 0) {
+      size_t total = n - rtp_start + len;
+      h[2] = total >> 8;
+      h[3] = total & 0xff;
+    }
+
+    if (!cb(arg, h, n, f->scan + offset, len))
+      return -1;
+    s->seq++;
+    packets++;
+    offset += len;
+  }
+  return packets;
+}
+
+uint32_t rtp_timestamp(uint32_t sec, uint32_t usec) {
+  return sec * RTP_CLOCK + (uint32_t)((uint64_t)usec * RTP_CLOCK / 1000000);
+}
+
+// value of a header line, NULL if missing
+static const char *rtsp_header(const char *buf, size_t len, const char *name) {
+  size_t nlen = strlen(name);
+  const char *end = buf + len;
+
+  for (const char *p = buf; p < end; ) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (!eol)
+      eol = end;
+    if ((size_t)(eol - p) > nlen && !strncasecmp(p, name, nlen) && p[nlen] == ':') {
+      p += nlen + 1;
+      while (p < eol && *p == ' ')
+        p++;
+      return p;
+    }
+    p = eol + 1;
+  }
+  return NULL;
+}
+
+bool rtsp_parse_request(const char *buf, size_t len, rtsp_request_t *r) {
+  static const struct { const char *name; int method; } methods[] = {
+    { "OPTIONS ", RTSP_OPTIONS },
+    { "DESCRIBE ", RTSP_DESCRIBE },
+    { "SETUP ", RTSP_SETUP },
+    { "PLAY ", RTSP_PLAY },
+    { "TEARDOWN ", RTSP_TEARDOWN },
+  };
+  const char *v;
+
+  memset(r, 0, sizeof(*r));
+  for (unsigned int i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+    size_t n = strlen(methods[i].name);
+    if (len > n && !strncmp(buf, methods[i].name, n))
+      r->method = methods[i].method;
+  }
+
+  v = rtsp_header(buf, len, "CSeq");
+  if (!v)
+    return false;
+  r->cseq = atoi(v);
+
+  v = rtsp_header(buf, len, "Transport");
+  if (v) {
+    const char *eol = (const char *)memchr(v, '\n', buf + len - v);
+    size_t tlen = eol ? (size_t)(eol - v) : (size_t)(buf + len - v);
+    char t[128];
+    const char *p;
+
+    if (tlen >= sizeof(t))
+      tlen = sizeof(t) - 1;
+    memcpy(t, v, tlen);
+    t[tlen] = 0;
+    r->tcp = strstr(t, "RTP/AVP/TCP") != NULL;
+    if ((p = strstr(t, "client_port="))) {
+      r->client_port[0] = atoi(p + 12);
+      p = strchr(p, '-');
+      r->client_port[1] = p ? atoi(p + 1) : r->client_port[0] + 1;
+    }
+    if ((p = strstr(t, "interleaved="))) {
+      r->interleaved[0] = atoi(p + 12);
+      p = strchr(p, '-');
+      r->interleaved[1] = p ? atoi(p + 1) : r->interleaved[0] + 1;
+    } else if (r->tcp) {
+      r->interleaved[0] = 0;
+      r->interleaved[1] = 1;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,146 @@
+#include "telemetry_codec.h"
+
+#include <math.h>
+
+void telemetry_init(telemetry_state_t *s, const telemetry_channel_t *channels,
+  uint8_t count, uint8_t keyframe_interval) {
+  s->channels = channels;
+  s->count = count > TELEMETRY_MAX_CHANNELS ? TELEMETRY_MAX_CHANNELS : count;
+  s->keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+  telemetry_reset(s);
+}
+
+// FNV-1a over scale and delta of the channels, folded to a byte
+static uint8_t telemetry_schema(const telemetry_state_t *s) {
+  uint32_t h = 2166136261u;
+
+  for (unsigned int i = 0; i < s->count; i++) {
+    // the scale in thousandths, independent of the float layout
+    uint32_t scale = (uint32_t)lroundf(s->channels[i].scale * 1000);
+    uint8_t bytes[5] = { (uint8_t)scale, (uint8_t)(scale >> 8), (uint8_t)(scale >> 16),
+      (uint8_t)(scale >> 24), s->channels[i].delta };
+    for (unsigned int b = 0; b < sizeof(bytes); b++)
+      h = (h ^ bytes[b]) * 16777619u;
+  }
+  return (uint8_t)(h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24));
+}
+
+void telemetry_reset(telemetry_state_t *s) {
+  s->schema = telemetry_schema(s);
+  s->seq = 0;
+  s->known = 0;
+  for (unsigned int i = 0; i < TELEMETRY_MAX_CHANNELS; i++)
+    s->last[i] = 0;
+}
+
+static size_t put_varint(uint8_t *buf, size_t size, int32_t v) {
+  // zigzag, so small negative differences stay short
+  uint32_t u = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+  size_t n = 0;
+
+  do {
+    if (n == size)
+      return 0;
+    buf[n++] = (u & 0x7f) | (u > 0x7f ? 0x80 : 0);
+    u >>= 7;
+  } while (u);
+  return n;
+}
+
+static size_t get_varint(const uint8_t *buf, size_t len, int32_t *v) {
+  uint32_t u = 0;
+  size_t n = 0;
+
+  for (unsigned int shift = 0; shift < 35; shift += 7) {
+    if (n == len)
+      return 0;
+    u |= (uint32_t)(buf[n] & 0x7f) << shift;
+    if (!(buf[n++] & 0x80)) {
+      *v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+      return n;
+    }
+  }
+  return 0;
+}
+
+size_t telemetry_encode(telemetry_state_t *s, const float *values, uint8_t mask,
+  uint8_t *buf, size_t size) {
+  size_t n = TELEMETRY_HEADER_LEN;
+
+  if (size < TELEMETRY_HEADER_LEN)
+    return 0;
+  mask &= (uint8_t)((1 << s->count) - 1);
+  // a channel sent for the first time needs a keyframe, the decoder could
+  // not tell its absolute value from a difference
+  bool keyframe = (mask & ~s->known) || (s->seq % s->keyframe_interval) == 0;
+  buf[0] = (TELEMETRY_VERSION << 4) | (keyframe ? TELEMETRY_KEYFRAME : 0);
+  buf[1] = s->seq;
+  buf[2] = mask;
+  buf[3] = s->schema;
+
+  int32_t q[TELEMETRY_MAX_CHANNELS];
+  for (unsigned int i = 0; i < s->count; i++) {
+    if (!(mask & (1 << i)))
+      continue;
+    q[i] = (int32_t)lroundf(values[i] * s->channels[i].scale);
+    bool absolute = keyframe || !s->channels[i].delta;
+    size_t len = put_varint(buf + n, size - n, absolute ? q[i] : q[i] - s->last[i]);
+    if (!len)
+      return 0;
+    n += len;
+  }
+
+  // only commit once the packet is complete
+  for (unsigned int i = 0; i < s->count; i++) {
+    if (mask & (1 << i))
+      s->last[i] = q[i];
+  }
+  s->known |= mask;
+  s->seq++;
+  return n;
+}
+
+int telemetry_decode(telemetry_state_t *s, const uint8_t *buf, size_t len,
+  float *values) {
+  if (len < TELEMETRY_HEADER_LEN || (buf[0] >> 4) != TELEMETRY_VERSION)
+    return -1;
+  if (buf[3] != s->schema)
+    return TELEMETRY_OTHER_SCHEMA;
+
+  bool keyframe = buf[0] & TELEMETRY_KEYFRAME;
+  uint8_t mask = buf[2];
+  if (buf[1] != s->seq)
+    s->known = 0; // lost a packet, old values are no base for differences
+
+  int32_t q[TELEMETRY_MAX_CHANNELS];
+  uint8_t decoded = 0;
+  size_t n = TELEMETRY_HEADER_LEN;
+  for (unsigned int i = 0; i < s->count; i++) {
+    if (!(mask & (1 << i)))
+      continue;
+    int32_t v;
+    size_t used = get_varint(buf + n, len - n, &v);
+    if (!used)
+      return -1;
+    n += used;
+    if (keyframe || !s->channels[i].delta) {
+      q[i] = v;
+      decoded |= 1 << i;
+    } else if (s->known & (1 << i)) {
+      q[i] = s->last[i] + v;
+      decoded |= 1 << i;
+    }
+  }
+  if (n != len || (mask >> s->count))
+    return -1;
+
+  for (unsigned int i = 0; i < s->count; i++) {
+    if (!(decoded & (1 << i)))
+      continue;
+    s->last[i] = q[i];
+    values[i] = q[i] / s->channels[i].scale;
+  }
+  s->known = (s->known & ~mask) | decoded;
+  s->seq = buf[1] + 1;
+  return decoded;
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+#include <unity.h>
+
+#include "config_schema.h"
+
+static std::string name, server;
+static unsigned int port, interval;
+static bool enabled;
+
+static const char *string_get(const void *value) {
+  return ((const std::string *)value)->c_str();
+}
+
+static void string_set(void *value, const char *s) {
+  *(std::string *)value = s;
+}
+
+static int mqtt_applied, clip_applied;
+
+static void apply_mqtt(void) {
+  mqtt_applied++;
+}
+
+static void apply_clip(void) {
+  clip_applied++;
+}
+
+constexpr config_field_t fields[] = {
+  { 1, NULL, "myname", "myname", CONFIG_STRING, &name, "esp-camera", 0, 1, 32, apply_mqtt },
+  { 5, "mqtt", "server", "mqttserver", CONFIG_STRING, &server, "", 0, 0, 64, apply_mqtt },
+  { 6, "mqtt", "port", "mqttport", CONFIG_UINT, &port, NULL, 1883, 1, 65535, apply_mqtt },
+  { 12, "power", "interval", "dutyinterval", CONFIG_UINT, &interval, NULL, 300, 10, 86400, NULL },
+  { 16, "clip", "enabled", "clip", CONFIG_BOOL, &enabled, NULL, 0, 0, 1, apply_clip },
+};
+
+static_assert(config_ids_unique(fields), "ids must be unique");
+static_assert(config_defaults_valid(fields), "defaults must be in range");
+
+constexpr config_field_t duplicate_ids[] = {
+  { 1, NULL, "a", "a", CONFIG_UINT, &port, NULL, 0, 0, 1, NULL },
+  { 1, NULL, "b", "b", CONFIG_UINT, &port, NULL, 0, 0, 1, NULL },
+};
+static_assert(!config_ids_unique(duplicate_ids), "duplicate ids are found");
+
+constexpr config_field_t bad_defaults[][1] = {
+  { { 1, NULL, "a", "a", CONFIG_STRING, &name, "", 0, 1, 8, NULL } },
+  { { 1, NULL, "a", "a", CONFIG_STRING, &name, "too long", 0, 0, 4, NULL } },
+  { { 1, NULL, "a", "a", CONFIG_STRING, &name, NULL, 0, 0, 4, NULL } },
+  { { 1, NULL, "a", "a", CONFIG_UINT, &port, NULL, 0, 1, 4, NULL } },
+};
+static_assert(!config_defaults_valid(bad_defaults[0]), "short string default is found");
+static_assert(!config_defaults_valid(bad_defaults[1]), "long string default is found");
+static_assert(!config_defaults_valid(bad_defaults[2]), "missing string default is found");
+static_assert(!config_defaults_valid(bad_defaults[3]), "number default out of range is found");
+
+static const config_schema_t schema = {
+  fields, sizeof(fields) / sizeof(fields[0]), string_get, string_set
+};
+
+void setUp(void) {
+  config_defaults(&schema);
+}
+
+void tearDown(void) {
+}
+
+void test_defaults(void) {
+  TEST_ASSERT_EQUAL_STRING("esp-camera", name.c_str());
+  TEST_ASSERT_EQUAL_STRING("", server.c_str());
+  TEST_ASSERT_EQUAL(1883, port);
+  TEST_ASSERT_EQUAL(300, interval);
+  TEST_ASSERT_FALSE(enabled);
+}
+
+void test_parse(void) {
+  const config_field_t *c = config_find(&schema, "mqttport");
+
+  TEST_ASSERT_NOT_NULL(c);
+  TEST_ASSERT_NULL(config_find(&schema, "port"));
+  TEST_ASSERT_TRUE(config_parse(&schema, c, "8883"));
+  TEST_ASSERT_EQUAL(8883, port);
+  TEST_ASSERT_FALSE(config_parse(&schema, c, "0"));
+  TEST_ASSERT_FALSE(config_parse(&schema, c, "65536"));
+  TEST_ASSERT_FALSE(config_parse(&schema, c, "88x"));
+  TEST_ASSERT_FALSE(config_parse(&schema, c, ""));
+  TEST_ASSERT_EQUAL(8883, port);
+
+  c = config_find(&schema, "clip");
+  TEST_ASSERT_TRUE(config_parse(&schema, c, "on"));
+  TEST_ASSERT_TRUE(enabled);
+  TEST_ASSERT_TRUE(config_parse(&schema, c, "false"));
+  TEST_ASSERT_FALSE(enabled);
+  TEST_ASSERT_FALSE(config_parse(&schema, c, "yes"));
+
+  c = config_find(&schema, "myname");
+  TEST_ASSERT_FALSE(config_parse(&schema, c, ""));
+  TEST_ASSERT_FALSE(config_parse(&schema, c, "a-name-that-is-longer-than-32-chars"));
+  TEST_ASSERT_TRUE(config_parse(&schema, c, "cam1"));
+  TEST_ASSERT_EQUAL_STRING("cam1", name.c_str());
+}
+
+// values as config.json holds them, read back through config_parse
+void test_text_round_trip(void) {
+  const char *text[] = { "garage", "broker.local", "1", "86400", "true" };
+
+  for (size_t i = 0; i < schema.count; i++)
+    TEST_ASSERT_TRUE(config_parse(&schema, &fields[i], text[i]));
+  TEST_ASSERT_EQUAL_STRING("garage", name.c_str());
+  TEST_ASSERT_EQUAL_STRING("broker.local", server.c_str());
+  TEST_ASSERT_EQUAL(1, port);
+  TEST_ASSERT_EQUAL(86400, interval);
+  TEST_ASSERT_TRUE(enabled);
+}
+
+void test_binary_round_trip(void) {
+  uint8_t buf[256];
+
+  name = "garage";
+  server = std::string(64, 's');
+  port = 65535;
+  interval = 10;
+  enabled = true;
+  size_t len = config_encode(&schema, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(sizeof(config_header_t) + 5 * 2 + 6 + 64 + 4 + 4 + 1, len);
+
+  config_defaults(&schema);
+  TEST_ASSERT_EQUAL(0, config_decode(&schema, buf, len));
+  TEST_ASSERT_EQUAL_STRING("garage", name.c_str());
+  TEST_ASSERT_EQUAL_STRING(std::string(64, 's').c_str(), server.c_str());
+  TEST_ASSERT_EQUAL(65535, port);
+  TEST_ASSERT_EQUAL(10, interval);
+  TEST_ASSERT_TRUE(enabled);
+}
+
+void test_encode_too_small(void) {
+  uint8_t buf[256];
+  size_t len = config_encode(&schema, buf, sizeof(buf));
+
+  TEST_ASSERT_EQUAL(0, config_encode(&schema, buf, len - 1));
+  TEST_ASSERT_EQUAL(0, config_encode(&schema, buf, sizeof(config_header_t) - 1));
+}
+
+void test_broken_files_are_ignored(void) {
+  uint8_t buf[256], copy[256];
+
+  port = 1234;
+  size_t len = config_encode(&schema, buf, sizeof(buf));
+  port = 1883;
+
+  // every single bit flip is caught by the header checks or the CRC
+  for (size_t i = 0; i < len * 8; i++) {
+    memcpy(copy, buf, len);
+    copy[i / 8] ^= 1 << (i % 8);
+    TEST_ASSERT_EQUAL(-1, config_decode(&schema, copy, len));
+  }
+  TEST_ASSERT_EQUAL(-1, config_decode(&schema, buf, len - 1));
+  TEST_ASSERT_EQUAL(-1, config_decode(&schema, buf, 3));
+  TEST_ASSERT_EQUAL(1883, port);
+}
+
+// header for records written by hand
+static void reseal(uint8_t *buf, size_t len) {
+  config_header_t h;
+  h.magic = CONFIG_MAGIC;
+  h.version = CONFIG_VERSION;
+  h.len = len - sizeof(h);
+  h.crc = config_crc32(buf + sizeof(h), h.len);
+  memcpy(buf, &h, sizeof(h));
+}
+
+void test_unknown_and_missing_records(void) {
+  uint8_t buf[64];
+  size_t len = sizeof(config_header_t);
+
+  // a field of a newer firmware, then only the port
+  const uint8_t records[] = { 99, 3, 'n', 'e', 'w', 6, 4, 0x5b, 0x22, 0, 0 };
+  memcpy(buf + len, records, sizeof(records));
+  len += sizeof(records);
+  reseal(buf, len);
+
+  name = "changed";
+  TEST_ASSERT_EQUAL(0, config_decode(&schema, buf, len));
+  TEST_ASSERT_EQUAL(8795, port);
+  // fields without a record are left alone
+  TEST_ASSERT_EQUAL_STRING("changed", name.c_str());
+}
+
+void test_invalid_records(void) {
+  uint8_t buf[64];
+  size_t len = sizeof(config_header_t);
+
+  const uint8_t records[] = {
+    6, 4, 0, 0, 0, 0,         // port 0, below the range
+    16, 1, 2,                 // flag neither 0 nor 1
+    1, 0,                     // empty name, below the minimum length
+    12, 2, 60, 0,             // wrong length for a number
+    12, 4, 60, 0, 0, 0,       // valid interval
+  };
+  memcpy(buf + len, records, sizeof(records));
+  len += sizeof(records);
+  reseal(buf, len);
+
+  TEST_ASSERT_EQUAL(4, config_decode(&schema, buf, len));
+  TEST_ASSERT_EQUAL(1883, port);
+  TEST_ASSERT_FALSE(enabled);
+  TEST_ASSERT_EQUAL_STRING("esp-camera", name.c_str());
+  TEST_ASSERT_EQUAL(60, interval);
+}
+
+// each hook once, however many fields share it
+void test_apply_all(void) {
+  mqtt_applied = clip_applied = 0;
+  config_apply_all(&schema);
+  TEST_ASSERT_EQUAL(1, mqtt_applied);
+  TEST_ASSERT_EQUAL(1, clip_applied);
+}
+
+void test_crc32(void) {
+  TEST_ASSERT_EQUAL_HEX32(0xcbf43926, config_crc32((const uint8_t *)"123456789", 9));
+  TEST_ASSERT_EQUAL_HEX32(0, config_crc32(NULL, 0));
+}
+
+// what setup_readconfig spends on config.bin, without the file system
+void test_load_time(void) {
+  uint8_t buf[256];
+  const int loads = 10000;
+
+  name = "garage";
+  server = "broker.local";
+  size_t len = config_encode(&schema, buf, sizeof(buf));
+
+  clock_t start = clock();
+  for (int i = 0; i < loads; i++)
+    TEST_ASSERT_EQUAL(0, config_decode(&schema, buf, len));
+  double us = (double)(clock() - start) * 1e6 / CLOCKS_PER_SEC / loads;
+  printf("config.bin load: %.2f us for %zu bytes\n", us, len);
+  // far below parsing the JSON, even on a slow host
+  TEST_ASSERT_TRUE(us < 50);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_defaults);
+  RUN_TEST(test_parse);
+  RUN_TEST(test_text_round_trip);
+  RUN_TEST(test_binary_round_trip);
+  RUN_TEST(test_encode_too_small);
+  RUN_TEST(test_broken_files_are_ignored);
+  RUN_TEST(test_unknown_and_missing_records);
+  RUN_TEST(test_invalid_records);
+  RUN_TEST(test_apply_all);
+  RUN_TEST(test_crc32);
+  RUN_TEST(test_load_time);
+  return UNITY_END();
+}
@@ -0,0 +1,143 @@
+#include <unity.h>
+
+#include "duty_cycle.h"
+
+static duty_cycle_t d;
+
+void setUp(void) {
+  duty_init(&d, 0);
+}
+
+void tearDown(void) {
+}
+
+// run one wake cycle, answering every action from results in turn, and
+// return the actions as a string of digits
+static const char *run_cycle(const char *results) {
+  static char actions[16];
+  int n = 0;
+  int a = duty_next(&d, DUTY_START);
+
+  while (n < 15) {
+    actions[n++] = '0' + a;
+    if (a == DUTY_SLEEP)
+      break;
+    int event = *results ? (*results++ == '+' ? DUTY_OK : DUTY_FAIL) : DUTY_OK;
+    a = duty_next(&d, event);
+  }
+  actions[n] = 0;
+  return actions;
+}
+
+void test_first_cycle_full_connect(void) {
+  // read, full, mqtt, publish, sleep
+  TEST_ASSERT_EQUAL_STRING("02346", run_cycle("++++"));
+  TEST_ASSERT_TRUE(d.fast_valid);
+  TEST_ASSERT_EQUAL(1, d.cycle);
+  TEST_ASSERT_EQUAL(0, d.failed_connects);
+}
+
+void test_fast_path_after_full_connect(void) {
+  run_cycle("++++");
+  TEST_ASSERT_EQUAL_STRING("01346", run_cycle("++++"));
+}
+
+void test_fast_path_falls_back(void) {
+  run_cycle("++++");
+  // fast fails, full works
+  TEST_ASSERT_EQUAL_STRING("012346", run_cycle("+-+++"));
+  TEST_ASSERT_TRUE(d.fast_valid);
+  TEST_ASSERT_EQUAL_STRING("01346", run_cycle("++++"));
+}
+
+void test_full_connect_fails(void) {
+  TEST_ASSERT_EQUAL_STRING("026", run_cycle("+-"));
+  TEST_ASSERT_FALSE(d.fast_valid);
+  TEST_ASSERT_EQUAL(1, d.failed_connects);
+  // fast path is not tried until a full connect succeeded again
+  TEST_ASSERT_EQUAL_STRING("026", run_cycle("+-"));
+  TEST_ASSERT_EQUAL(2, d.failed_connects);
+}
+
+void test_both_connects_fail(void) {
+  run_cycle("++++");
+  TEST_ASSERT_EQUAL_STRING("0126", run_cycle("+--"));
+  TEST_ASSERT_FALSE(d.fast_valid);
+  TEST_ASSERT_EQUAL(1, d.failed_connects);
+}
+
+void test_mqtt_fails(void) {
+  run_cycle("++++");
+  TEST_ASSERT_EQUAL_STRING("0136", run_cycle("++-"));
+  TEST_ASSERT_EQUAL(1, d.failed_connects);
+  // WiFi worked, the fast path stays
+  TEST_ASSERT_TRUE(d.fast_valid);
+  TEST_ASSERT_EQUAL_STRING("01346", run_cycle("++++"));
+  TEST_ASSERT_EQUAL(0, d.failed_connects);
+}
+
+void test_failed_sensor_read_still_connects(void) {
+  TEST_ASSERT_EQUAL_STRING("02346", run_cycle("-+++"));
+}
+
+void test_snapshot_every_third_cycle(void) {
+  duty_init(&d, 3);
+  TEST_ASSERT_EQUAL_STRING("02346", run_cycle(""));
+  TEST_ASSERT_EQUAL_STRING("01346", run_cycle(""));
+  TEST_ASSERT_EQUAL_STRING("013456", run_cycle(""));
+  TEST_ASSERT_EQUAL_STRING("01346", run_cycle(""));
+}
+
+void test_no_snapshot_after_failed_publish(void) {
+  duty_init(&d, 1);
+  TEST_ASSERT_EQUAL_STRING("02346", run_cycle("+++-"));
+  TEST_ASSERT_EQUAL_STRING("013456", run_cycle(""));
+}
+
+void test_events_while_asleep(void) {
+  run_cycle("");
+  TEST_ASSERT_EQUAL(DUTY_SLEEP, duty_next(&d, DUTY_OK));
+  TEST_ASSERT_EQUAL(DUTY_SLEEP, duty_next(&d, DUTY_FAIL));
+  TEST_ASSERT_EQUAL(1, d.cycle);
+}
+
+void test_sleep_time(void) {
+  // cycles start every interval, the time awake is taken off
+  TEST_ASSERT_EQUAL_UINT64(300000000ULL - 4000000ULL, duty_sleep_us(&d, 300, 4000));
+  // at least a second, even when the cycle overran
+  TEST_ASSERT_EQUAL_UINT64(1000000ULL, duty_sleep_us(&d, 10, 9500));
+  TEST_ASSERT_EQUAL_UINT64(1000000ULL, duty_sleep_us(&d, 10, 60000));
+}
+
+void test_sleep_backoff(void) {
+  const uint64_t expected[] = { 1, 2, 4, 8, 16, 16, 16 };
+
+  for (unsigned int i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+    d.failed_connects = i;
+    TEST_ASSERT_EQUAL_UINT64(expected[i] * 60000000ULL, duty_sleep_us(&d, 60, 0));
+  }
+  // failed cycles back off, the first good one ends it
+  duty_init(&d, 0);
+  run_cycle("+-");
+  run_cycle("+-");
+  TEST_ASSERT_EQUAL_UINT64(4 * 60000000ULL, duty_sleep_us(&d, 60, 0));
+  run_cycle("++++");
+  TEST_ASSERT_EQUAL_UINT64(60000000ULL, duty_sleep_us(&d, 60, 0));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_cycle_full_connect);
+  RUN_TEST(test_fast_path_after_full_connect);
+  RUN_TEST(test_fast_path_falls_back);
+  RUN_TEST(test_full_connect_fails);
+  RUN_TEST(test_both_connects_fail);
+  RUN_TEST(test_mqtt_fails);
+  RUN_TEST(test_failed_sensor_read_still_connects);
+  RUN_TEST(test_snapshot_every_third_cycle);
+  RUN_TEST(test_no_snapshot_after_failed_publish);
+  RUN_TEST(test_events_while_asleep);
+  RUN_TEST(test_sleep_time);
+  RUN_TEST(test_sleep_backoff);
+  return UNITY_END();
+}
@@ -0,0 +1,437 @@
+#include <unity.h>
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "jpeg_encoder.h"
+
+// A minimal baseline decoder, just enough to read back what jpeg_encode
+// writes: Huffman coded, no restart markers, no subsampling other than
+// horizontal, float IDCT. Planes are returned at full resolution.
+
+static const uint8_t zigzag[64] = {
+  0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+typedef struct {
+  uint8_t vals[256];
+  int mincode[17];
+  int maxcode[17];
+  int valptr[17];
+} huffman_t;
+
+typedef struct {
+  int width;
+  int height;
+  int components;
+  int h[3];
+  int tq[3];
+  int td[3];
+  int ta[3];
+  uint8_t qt[4][64];          // zigzag order, as in the file
+  huffman_t dc[4];
+  huffman_t ac[4];
+  std::vector<uint8_t> plane[3];
+} image_t;
+
+typedef struct {
+  const uint8_t *p;
+  const uint8_t *end;
+  uint32_t acc;
+  int n;
+} bits_t;
+
+static int get_bit(bits_t *b) {
+  if (!b->n) {
+    uint8_t c = b->p < b->end ? *b->p++ : 0;
+    if (c == 0xff && b->p < b->end && *b->p == 0)
+      b->p++;  // stuffed zero
+    b->acc = c;
+    b->n = 8;
+  }
+  b->n--;
+  return (b->acc >> b->n) & 1;
+}
+
+static int get_bits(bits_t *b, int n) {
+  int v = 0;
+  while (n--)
+    v = (v << 1) | get_bit(b);
+  return v;
+}
+
+static int extend(int v, int s) {
+  return v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+}
+
+static int decode_symbol(bits_t *b, const huffman_t *t) {
+  int code = 0;
+  for (int l = 1; l <= 16; l++) {
+    code = (code << 1) | get_bit(b);
+    if (code <= t->maxcode[l])
+      return t->vals[t->valptr[l] + code - t->mincode[l]];
+  }
+  return -1;
+}
+
+static void idct(const int *coef, uint8_t *out, int stride) {
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      double sum = 0;
+      for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+          double cu = u ? 1 : M_SQRT1_2, cv = v ? 1 : M_SQRT1_2;
+          sum += cu * cv * coef[v * 8 + u] *
+            cos((2 * x + 1) * u * M_PI / 16) * cos((2 * y + 1) * v * M_PI / 16);
+        }
+      }
+      int p = (int)lround(sum / 4 + 128);
+      out[y * stride + x] = p < 0 ? 0 : p > 255 ? 255 : p;
+    }
+  }
+}
+
+static bool decode(const std::vector<uint8_t> &jpg, image_t *img) {
+  const uint8_t *p = jpg.data(), *end = p + jpg.size();
+
+  if (jpg.size() < 4 || p[0] != 0xff || p[1] != 0xd8)
+    return false;
+  p += 2;
+  while (p + 4 <= end) {
+    if (p[0] != 0xff)
+      return false;
+    uint8_t marker = p[1];
+    int len = (p[2] << 8) | p[3];
+    const uint8_t *s = p + 4, *e = p + 2 + len;
+    if (marker == 0xdb) {
+      while (s < e) {
+        memcpy(img->qt[s[0] & 3], s + 1, 64);
+        s += 65;
+      }
+    } else if (marker == 0xc0) {
+      img->height = (s[1] << 8) | s[2];
+      img->width = (s[3] << 8) | s[4];
+      img->components = s[5];
+      for (int c = 0; c < img->components; c++) {
+        img->h[c] = s[7 + c * 3] >> 4;
+        img->tq[c] = s[8 + c * 3];
+      }
+    } else if (marker == 0xc4) {
+      while (s < e) {
+        huffman_t *t = (s[0] >> 4) ? &img->ac[s[0] & 3] : &img->dc[s[0] & 3];
+        int code = 0, k = 0;
+        for (int l = 1; l <= 16; l++) {
+          t->valptr[l] = k;
+          t->mincode[l] = code;
+          code += s[l];
+          k += s[l];
+          t->maxcode[l] = s[l] ? code - 1 : -1;
+          code <<= 1;
+        }
+        memcpy(t->vals, s + 17, k);
+        s += 17 + k;
+      }
+    } else if (marker == 0xda) {
+      for (int c = 0; c < img->components; c++) {
+        img->td[c] = s[2 + c * 2] >> 4;
+        img->ta[c] = s[2 + c * 2] & 15;
+      }
+      p = e;
+      break;
+    } else if (marker == 0xc2 || marker == 0xd9) {
+      return false;
+    }
+    p = e;
+  }
+  if (!img->components)
+    return false;
+
+  // entropy coded data, MCUs of hmax x 1 blocks
+  int hmax = img->h[0];
+  int mcus_x = (img->width + 8 * hmax - 1) / (8 * hmax);
+  int mcus_y = (img->height + 7) / 8;
+  int stride[3];
+  for (int c = 0; c < img->components; c++) {
+    stride[c] = mcus_x * 8 * img->h[c];
+    img->plane[c].assign(stride[c] * mcus_y * 8, 0);
+  }
+  bits_t b = { p, end, 0, 0 };
+  int dc[3] = { 0, 0, 0 };
+  for (int my = 0; my < mcus_y; my++) {
+    for (int mx = 0; mx < mcus_x; mx++) {
+      for (int c = 0; c < img->components; c++) {
+        for (int bx = 0; bx < img->h[c]; bx++) {
+          int coef[64] = { 0 };
+          const uint8_t *q = img->qt[img->tq[c]];
+          int s = decode_symbol(&b, &img->dc[img->td[c]]);
+          if (s < 0)
+            return false;
+          dc[c] += s ? extend(get_bits(&b, s), s) : 0;
+          coef[0] = dc[c] * q[0];
+          for (int k = 1; k < 64; k++) {
+            int rs = decode_symbol(&b, &img->ac[img->ta[c]]);
+            if (rs < 0)
+              return false;
+            if (!(rs & 15)) {
+              if (rs != 0xf0)
+                break;
+              k += 15;
+              continue;
+            }
+            k += rs >> 4;
+            if (k > 63)
+              return false;
+            coef[zigzag[k]] = extend(get_bits(&b, rs & 15), rs & 15) * q[k];
+          }
+          idct(coef, &img->plane[c][my * 8 * stride[c] + (mx * img->h[c] + bx) * 8], stride[c]);
+        }
+      }
+    }
+  }
+
+  // crop and bring chroma to full resolution
+  for (int c = 0; c < img->components; c++) {
+    std::vector<uint8_t> full(img->width * img->height);
+    int scale = hmax / img->h[c];
+    for (int y = 0; y < img->height; y++) {
+      for (int x = 0; x < img->width; x++)
+        full[y * img->width + x] = img->plane[c][y * stride[c] + x / scale];
+    }
+    img->plane[c].swap(full);
+  }
+  return true;
+}
+
+// the encoder and the test image
+
+static size_t collect(void *arg, size_t, const void *data, size_t len) {
+  std::vector<uint8_t> *out = (std::vector<uint8_t> *)arg;
+  out->insert(out->end(), (const uint8_t *)data, (const uint8_t *)data + len);
+  return len;
+}
+
+static std::vector<uint8_t> encode(const std::vector<uint8_t> &src, int width, int height,
+  int format, uint8_t quality, size_t bufsize = 1024) {
+  std::vector<uint8_t> out;
+  std::vector<uint8_t> buf(bufsize);
+  TEST_ASSERT_TRUE(jpeg_encode(src.data(), width, height, format, quality,
+    buf.data(), buf.size(), collect, &out));
+  return out;
+}
+
+typedef struct {
+  int width;
+  int height;
+  std::vector<uint8_t> y, cb, cr;  // full resolution
+} ycc_t;
+
+// smooth shading with a few edges, about what a camera sees
+static ycc_t make_ycc(int width, int height) {
+  ycc_t img = { width, height, {}, {}, {} };
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      double r = 128 + 100 * sin(x / 17.0) * cos(y / 23.0);
+      double g = 40 + x * 170 / width;
+      double b = ((x / 24 + y / 24) & 1) ? 200 : 60;
+      img.y.push_back((uint8_t)lround(0.299 * r + 0.587 * g + 0.114 * b));
+      img.cb.push_back((uint8_t)lround(128 - 0.168736 * r - 0.331264 * g + 0.5 * b));
+      img.cr.push_back((uint8_t)lround(128 + 0.5 * r - 0.418688 * g - 0.081312 * b));
+    }
+  }
+  return img;
+}
+
+// Y0 U Y1 V, chroma of the pair averaged like the sensor does
+static std::vector<uint8_t> to_yuv422(const ycc_t &img) {
+  std::vector<uint8_t> out;
+  for (int i = 0; i < img.width * img.height; i += 2) {
+    out.push_back(img.y[i]);
+    out.push_back((img.cb[i] + img.cb[i + 1] + 1) / 2);
+    out.push_back(img.y[i + 1]);
+    out.push_back((img.cr[i] + img.cr[i + 1] + 1) / 2);
+  }
+  return out;
+}
+
+static double psnr(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) {
+  double se = 0;
+  TEST_ASSERT_EQUAL(a.size(), b.size());
+  for (size_t i = 0; i < a.size(); i++)
+    se += (a[i] - b[i]) * (a[i] - b[i]);
+  if (se == 0)
+    return 99;
+  return 10 * log10(255.0 * 255.0 * a.size() / se);
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_yuv422(void) {
+  ycc_t src = make_ycc(160, 120);
+  image_t img;
+
+  TEST_ASSERT_TRUE(decode(encode(to_yuv422(src), 160, 120, JPEG_YUV422, 90), &img));
+  TEST_ASSERT_EQUAL(160, img.width);
+  TEST_ASSERT_EQUAL(120, img.height);
+  TEST_ASSERT_EQUAL(3, img.components);
+  TEST_ASSERT_EQUAL(2, img.h[0]);
+  TEST_ASSERT_TRUE(psnr(src.y, img.plane[0]) > 38);
+  TEST_ASSERT_TRUE(psnr(src.cb, img.plane[1]) > 34);
+  TEST_ASSERT_TRUE(psnr(src.cr, img.plane[2]) > 34);
+}
+
+void test_quality_order(void) {
+  std::vector<uint8_t> yuv = to_yuv422(make_ycc(160, 120));
+  ycc_t src = make_ycc(160, 120);
+  const uint8_t qualities[] = { 30, 50, 75, 80, 90 };
+  double last = 0;
+  size_t last_size = 0;
+
+  for (unsigned int i = 0; i < sizeof(qualities); i++) {
+    image_t img;
+    std::vector<uint8_t> jpg = encode(yuv, 160, 120, JPEG_YUV422, qualities[i]);
+    TEST_ASSERT_TRUE(decode(jpg, &img));
+    double p = psnr(src.y, img.plane[0]);
+    TEST_ASSERT_TRUE(p > last);
+    TEST_ASSERT_GREATER_THAN(last_size, jpg.size());
+    last = p;
+    last_size = jpg.size();
+  }
+  TEST_ASSERT_TRUE(last > 30);
+}
+
+// RGB565 goes through its own color conversion, it has to end up where
+// YUV422 of the same picture does
+void test_rgb565_matches_yuv422(void) {
+  const int w = 160, h = 120;
+  std::vector<uint8_t> rgb, yuv;
+  ycc_t ref = { w, h, {}, {}, {} };
+
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      int r = (x * 2) & 0xf8, g = (y * 2) & 0xfc, b = ((x + y) & 64) ? 0xf8 : 0x40;
+      uint16_t p = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+      rgb.push_back(p >> 8);
+      rgb.push_back(p & 0xff);
+      ref.y.push_back((uint8_t)lround(0.299 * r + 0.587 * g + 0.114 * b));
+      ref.cb.push_back((uint8_t)lround(128 - 0.168736 * r - 0.331264 * g + 0.5 * b));
+      ref.cr.push_back((uint8_t)lround(128 + 0.5 * r - 0.418688 * g - 0.081312 * b));
+    }
+  }
+  yuv = to_yuv422(ref);
+
+  image_t a, b;
+  TEST_ASSERT_TRUE(decode(encode(rgb, w, h, JPEG_RGB565, 90), &a));
+  TEST_ASSERT_TRUE(decode(encode(yuv, w, h, JPEG_YUV422, 90), &b));
+  TEST_ASSERT_TRUE(psnr(a.plane[0], b.plane[0]) > 36);
+  TEST_ASSERT_TRUE(psnr(a.plane[1], b.plane[1]) > 34);
+  TEST_ASSERT_TRUE(psnr(a.plane[2], b.plane[2]) > 34);
+  TEST_ASSERT_TRUE(psnr(ref.y, a.plane[0]) > 36);
+}
+
+void test_grayscale(void) {
+  ycc_t src = make_ycc(96, 64);
+  image_t img;
+
+  TEST_ASSERT_TRUE(decode(encode(src.y, 96, 64, JPEG_GRAYSCALE, 90), &img));
+  TEST_ASSERT_EQUAL(1, img.components);
+  TEST_ASSERT_TRUE(psnr(src.y, img.plane[0]) > 38);
+}
+
+// partial MCUs at the right and bottom edge repeat the last pixels
+void test_odd_size(void) {
+  ycc_t src = make_ycc(100, 75);
+  image_t img;
+
+  TEST_ASSERT_TRUE(decode(encode(to_yuv422(src), 100, 75, JPEG_YUV422, 90), &img));
+  TEST_ASSERT_EQUAL(100, img.width);
+  TEST_ASSERT_EQUAL(75, img.height);
+  TEST_ASSERT_TRUE(psnr(src.y, img.plane[0]) > 38);
+}
+
+// the output does not depend on how it is cut into callbacks
+void test_buffer_size(void) {
+  std::vector<uint8_t> yuv = to_yuv422(make_ycc(160, 120));
+  std::vector<uint8_t> small = encode(yuv, 160, 120, JPEG_YUV422, 80, 256);
+  std::vector<uint8_t> large = encode(yuv, 160, 120, JPEG_YUV422, 80, 64 * 1024);
+
+  TEST_ASSERT_EQUAL(large.size(), small.size());
+  TEST_ASSERT_EQUAL_MEMORY(large.data(), small.data(), large.size());
+}
+
+// prescaled tables and the ones scaled at run time both follow the IJG
+// scaling of the Annex K tables
+void test_quant_tables(void) {
+  static const uint8_t luma[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+  };
+  static const uint8_t chroma[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+  };
+  const uint8_t qualities[] = { 10, 50, 60, 75, 80, 90, 95, 100 };
+  std::vector<uint8_t> yuv = to_yuv422(make_ycc(16, 8));
+
+  for (unsigned int i = 0; i < sizeof(qualities); i++) {
+    int q = qualities[i];
+    int s = q < 50 ? 5000 / q : 200 - q * 2;
+    image_t img;
+    TEST_ASSERT_TRUE(decode(encode(yuv, 16, 8, JPEG_YUV422, q), &img));
+    for (int k = 0; k < 64; k++) {
+      int l = (luma[zigzag[k]] * s + 50) / 100, c = (chroma[zigzag[k]] * s + 50) / 100;
+      TEST_ASSERT_EQUAL(l < 1 ? 1 : l > 255 ? 255 : l, img.qt[0][k]);
+      TEST_ASSERT_EQUAL(c < 1 ? 1 : c > 255 ? 255 : c, img.qt[1][k]);
+    }
+  }
+}
+
+void test_rejects(void) {
+  uint8_t src[64] = { 0 }, buf[256];
+  std::vector<uint8_t> out;
+
+  TEST_ASSERT_FALSE(jpeg_encode(src, 8, 8, 7, 80, buf, sizeof(buf), collect, &out));
+  TEST_ASSERT_FALSE(jpeg_encode(src, 0, 8, JPEG_GRAYSCALE, 80, buf, sizeof(buf), collect, &out));
+  TEST_ASSERT_FALSE(jpeg_encode(src, 8, 8, JPEG_GRAYSCALE, 80, buf, 100, collect, &out));
+}
+
+void test_subsample(void) {
+  uint8_t src[8 * 4], out[sizeof(src)];
+  uint16_t w, h;
+
+  for (size_t i = 0; i < sizeof(src); i++)
+    src[i] = i;
+  TEST_ASSERT_TRUE(jpeg_subsample(src, 8, 4, JPEG_GRAYSCALE, 2, out, sizeof(out), &w, &h));
+  TEST_ASSERT_EQUAL(4, w);
+  TEST_ASSERT_EQUAL(2, h);
+  const uint8_t expected[] = { 0, 2, 4, 6, 16, 18, 20, 22 };
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, out, sizeof(expected));
+
+  TEST_ASSERT_FALSE(jpeg_subsample(src, 8, 4, JPEG_GRAYSCALE, 0, out, sizeof(out), &w, &h));
+  TEST_ASSERT_FALSE(jpeg_subsample(src, 8, 4, JPEG_GRAYSCALE, 2, out, 7, &w, &h));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_yuv422);
+  RUN_TEST(test_quality_order);
+  RUN_TEST(test_rgb565_matches_yuv422);
+  RUN_TEST(test_grayscale);
+  RUN_TEST(test_odd_size);
+  RUN_TEST(test_buffer_size);
+  RUN_TEST(test_quant_tables);
+  RUN_TEST(test_rejects);
+  RUN_TEST(test_subsample);
+  return UNITY_END();
+}
@@ -0,0 +1,256 @@
+#include <unity.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "jpeg_encoder.h"
+#include "rtsp_jpeg.h"
+
+#define WIDTH 160
+#define HEIGHT 120
+
+static std::vector<uint8_t> jpg;
+
+typedef struct {
+  std::vector<uint8_t> data;
+} packet_t;
+
+static std::vector<packet_t> packets;
+
+static size_t collect(void *arg, size_t, const void *data, size_t len) {
+  std::vector<uint8_t> *out = (std::vector<uint8_t> *)arg;
+  out->insert(out->end(), (const uint8_t *)data, (const uint8_t *)data + len);
+  return len;
+}
+
+static bool capture_packet(void *, const uint8_t *header, size_t header_len,
+  const uint8_t *payload, size_t payload_len) {
+  packet_t p;
+  p.data.assign(header, header + header_len);
+  p.data.insert(p.data.end(), payload, payload + payload_len);
+  packets.push_back(p);
+  return true;
+}
+
+static bool refuse_packet(void *, const uint8_t *, size_t, const uint8_t *, size_t) {
+  return false;
+}
+
+// a YUV422 test pattern through the project's own encoder
+static void make_jpeg() {
+  static uint8_t yuv[WIDTH * HEIGHT * 2];
+  uint8_t buf[1024];
+
+  for (int y = 0; y < HEIGHT; y++) {
+    for (int x = 0; x < WIDTH; x++) {
+      uint8_t *p = yuv + (y * WIDTH + x) * 2;
+      p[0] = (x & 1) ? (uint8_t)(x + y) : (uint8_t)(x ^ y);  // U or V
+      p[1] = (uint8_t)(x * 255 / WIDTH);                   // Y
+    }
+  }
+  jpg.clear();
+  TEST_ASSERT_TRUE(jpeg_encode(yuv, WIDTH, HEIGHT, JPEG_YUV422, 80, buf, sizeof(buf), collect, &jpg));
+}
+
+void setUp(void) {
+  make_jpeg();
+  packets.clear();
+}
+
+void tearDown(void) {
+}
+
+void test_parse_baseline(void) {
+  rtp_jpeg_frame_t f;
+
+  TEST_ASSERT_TRUE(rtp_jpeg_parse(jpg.data(), jpg.size(), &f));
+  TEST_ASSERT_EQUAL(WIDTH, f.width);
+  TEST_ASSERT_EQUAL(HEIGHT, f.height);
+  TEST_ASSERT_EQUAL(0, f.type);  // 4:2:2
+  TEST_ASSERT_NOT_NULL(f.qtables[0]);
+  TEST_ASSERT_NOT_NULL(f.qtables[1]);
+  // the scan runs up to the EOI marker
+  TEST_ASSERT_TRUE(f.scan > jpg.data());
+  TEST_ASSERT_EQUAL(jpg.size() - 2, (size_t)(f.scan - jpg.data()) + f.scan_len);
+  TEST_ASSERT_EQUAL(0xff, jpg[jpg.size() - 2]);
+  TEST_ASSERT_EQUAL(0xd9, jpg[jpg.size() - 1]);
+}
+
+void test_parse_rejects(void) {
+  rtp_jpeg_frame_t f;
+  std::vector<uint8_t> bad = jpg;
+
+  TEST_ASSERT_FALSE(rtp_jpeg_parse(jpg.data(), 3, &f));
+  bad[0] = 0;
+  TEST_ASSERT_FALSE(rtp_jpeg_parse(bad.data(), bad.size(), &f));
+
+  // progressive instead of baseline
+  bad = jpg;
+  for (size_t i = 2; i + 1 < bad.size(); i++) {
+    if (bad[i] == 0xff && bad[i + 1] == 0xc0) {
+      bad[i + 1] = 0xc2;
+      break;
+    }
+  }
+  TEST_ASSERT_FALSE(rtp_jpeg_parse(bad.data(), bad.size(), &f));
+
+  // cut inside the headers
+  TEST_ASSERT_FALSE(rtp_jpeg_parse(jpg.data(), 100, &f));
+}
+
+static void check_packets(size_t mtu, bool interleaved) {
+  rtp_jpeg_frame_t f;
+  rtp_session_t s = { 0xfffe, 0x12345678, interleaved ? 2 : -1 };
+  size_t prefix = interleaved ? 4 : 0;
+
+  TEST_ASSERT_TRUE(rtp_jpeg_parse(jpg.data(), jpg.size(), &f));
+  int n = rtp_jpeg_send(&s, &f, 0xa0b0c0d0, mtu, capture_packet, NULL);
+  TEST_ASSERT_EQUAL((int)packets.size(), n);
+  TEST_ASSERT_GREATER_THAN(1, n);
+  TEST_ASSERT_EQUAL(0xfffe + n - 0x10000, s.seq);
+
+  std::vector<uint8_t> scan;
+  for (int i = 0; i < n; i++) {
+    const uint8_t *p = packets[i].data.data();
+    size_t len = packets[i].data.size();
+
+    if (interleaved) {
+      TEST_ASSERT_EQUAL('$', p[0]);
+      TEST_ASSERT_EQUAL(2, p[1]);
+      TEST_ASSERT_EQUAL(len - 4, (size_t)((p[2] << 8) | p[3]));
+    }
+    p += prefix;
+    len -= prefix;
+    TEST_ASSERT_LESS_OR_EQUAL(mtu, len);
+
+    // RTP header
+    TEST_ASSERT_EQUAL(0x80, p[0]);
+    TEST_ASSERT_EQUAL(RTP_PAYLOAD_JPEG | (i == n - 1 ? 0x80 : 0), p[1]);
+    TEST_ASSERT_EQUAL((uint16_t)(0xfffe + i), (p[2] << 8) | p[3]);
+    TEST_ASSERT_EQUAL(0xa0b0c0d0, ((uint32_t)p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7]);
+    TEST_ASSERT_EQUAL(0x12345678, ((uint32_t)p[8] << 24) | (p[9] << 16) | (p[10] << 8) | p[11]);
+
+    // RFC 2435 main header, fragments are contiguous
+    const uint8_t *j = p + RTP_HEADER_LEN;
+    TEST_ASSERT_EQUAL(scan.size(), (size_t)((j[1] << 16) | (j[2] << 8) | j[3]));
+    TEST_ASSERT_EQUAL(0, j[4]);
+    TEST_ASSERT_EQUAL(255, j[5]);
+    TEST_ASSERT_EQUAL(WIDTH / 8, j[6]);
+    TEST_ASSERT_EQUAL(HEIGHT / 8, j[7]);
+    size_t header = RTP_HEADER_LEN + RTP_JPEG_HEADER_LEN;
+    if (i == 0) {
+      // quantization tables in band, first packet only
+      const uint8_t *q = j + RTP_JPEG_HEADER_LEN;
+      TEST_ASSERT_EQUAL(128, (q[2] << 8) | q[3]);
+      TEST_ASSERT_EQUAL_MEMORY(f.qtables[0], q + 4, 64);
+      TEST_ASSERT_EQUAL_MEMORY(f.qtables[1], q + 4 + 64, 64);
+      header += 4 + 128;
+    }
+    scan.insert(scan.end(), p + header, p + len);
+  }
+  TEST_ASSERT_EQUAL(f.scan_len, scan.size());
+  TEST_ASSERT_EQUAL_MEMORY(f.scan, scan.data(), scan.size());
+}
+
+void test_packetize_udp(void) {
+  check_packets(400, false);
+}
+
+void test_packetize_interleaved(void) {
+  check_packets(1400, true);
+}
+
+void test_restart_interval(void) {
+  // insert a DRI segment before SOS
+  std::vector<uint8_t> dri = jpg;
+  for (size_t i = 2; i + 1 < dri.size(); i++) {
+    if (dri[i] == 0xff && dri[i + 1] == 0xda) {
+      const uint8_t seg[] = { 0xff, 0xdd, 0x00, 0x04, 0x00, 0x05 };
+      dri.insert(dri.begin() + i, seg, seg + sizeof(seg));
+      break;
+    }
+  }
+  rtp_jpeg_frame_t f;
+  rtp_session_t s = { 0, 1, -1 };
+  TEST_ASSERT_TRUE(rtp_jpeg_parse(dri.data(), dri.size(), &f));
+  TEST_ASSERT_EQUAL(64, f.type);
+  TEST_ASSERT_EQUAL(5, f.restart_interval);
+  TEST_ASSERT_GREATER_THAN(0, rtp_jpeg_send(&s, &f, 0, 1400, capture_packet, NULL));
+  const uint8_t *r = packets[0].data.data() + RTP_HEADER_LEN + RTP_JPEG_HEADER_LEN;
+  TEST_ASSERT_EQUAL(5, (r[0] << 8) | r[1]);
+  TEST_ASSERT_EQUAL(0xff, r[2]);
+  TEST_ASSERT_EQUAL(0xff, r[3]);
+}
+
+void test_send_aborts(void) {
+  rtp_jpeg_frame_t f;
+  rtp_session_t s = { 7, 1, -1 };
+  TEST_ASSERT_TRUE(rtp_jpeg_parse(jpg.data(), jpg.size(), &f));
+  TEST_ASSERT_EQUAL(-1, rtp_jpeg_send(&s, &f, 0, 1400, refuse_packet, NULL));
+  TEST_ASSERT_EQUAL(7, s.seq);
+}
+
+void test_timestamp(void) {
+  TEST_ASSERT_EQUAL(90000, rtp_timestamp(1, 0));
+  TEST_ASSERT_EQUAL(45000, rtp_timestamp(0, 500000));
+  // wraps like the 32 bit RTP clock
+  TEST_ASSERT_EQUAL((uint32_t)(50000ULL * 90000), rtp_timestamp(50000, 0));
+}
+
+static bool parse(const char *req, rtsp_request_t *r) {
+  return rtsp_parse_request(req, strlen(req), r);
+}
+
+void test_parse_requests(void) {
+  rtsp_request_t r;
+
+  TEST_ASSERT_TRUE(parse("OPTIONS rtsp://cam/ RTSP/1.0\r\nCSeq: 1\r\n\r\n", &r));
+  TEST_ASSERT_EQUAL(RTSP_OPTIONS, r.method);
+  TEST_ASSERT_EQUAL(1, r.cseq);
+
+  TEST_ASSERT_TRUE(parse("DESCRIBE rtsp://cam/ RTSP/1.0\r\ncseq: 2\r\nAccept: application/sdp\r\n\r\n", &r));
+  TEST_ASSERT_EQUAL(RTSP_DESCRIBE, r.method);
+  TEST_ASSERT_EQUAL(2, r.cseq);
+
+  TEST_ASSERT_TRUE(parse("SETUP rtsp://cam/track1 RTSP/1.0\r\nCSeq: 3\r\n"
+    "Transport: RTP/AVP;unicast;client_port=5000-5001\r\n\r\n", &r));
+  TEST_ASSERT_EQUAL(RTSP_SETUP, r.method);
+  TEST_ASSERT_FALSE(r.tcp);
+  TEST_ASSERT_EQUAL(5000, r.client_port[0]);
+  TEST_ASSERT_EQUAL(5001, r.client_port[1]);
+
+  TEST_ASSERT_TRUE(parse("SETUP rtsp://cam/track1 RTSP/1.0\r\nCSeq: 4\r\n"
+    "Transport: RTP/AVP/TCP;unicast;interleaved=2-3\r\n\r\n", &r));
+  TEST_ASSERT_TRUE(r.tcp);
+  TEST_ASSERT_EQUAL(2, r.interleaved[0]);
+  TEST_ASSERT_EQUAL(3, r.interleaved[1]);
+
+  TEST_ASSERT_TRUE(parse("SETUP rtsp://cam/track1 RTSP/1.0\r\nCSeq: 5\r\n"
+    "Transport: RTP/AVP/TCP;unicast\r\n\r\n", &r));
+  TEST_ASSERT_EQUAL(0, r.interleaved[0]);
+  TEST_ASSERT_EQUAL(1, r.interleaved[1]);
+
+  TEST_ASSERT_TRUE(parse("PLAY rtsp://cam/ RTSP/1.0\r\nCSeq: 6\r\nSession: 1234\r\n\r\n", &r));
+  TEST_ASSERT_EQUAL(RTSP_PLAY, r.method);
+  TEST_ASSERT_TRUE(parse("TEARDOWN rtsp://cam/ RTSP/1.0\r\nCSeq: 7\r\n\r\n", &r));
+  TEST_ASSERT_EQUAL(RTSP_TEARDOWN, r.method);
+  TEST_ASSERT_TRUE(parse("GET_PARAMETER rtsp://cam/ RTSP/1.0\r\nCSeq: 8\r\n\r\n", &r));
+  TEST_ASSERT_EQUAL(RTSP_UNKNOWN, r.method);
+
+  // no CSeq, no answer possible
+  TEST_ASSERT_FALSE(parse("OPTIONS rtsp://cam/ RTSP/1.0\r\n\r\n", &r));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_baseline);
+  RUN_TEST(test_parse_rejects);
+  RUN_TEST(test_packetize_udp);
+  RUN_TEST(test_packetize_interleaved);
+  RUN_TEST(test_restart_interval);
+  RUN_TEST(test_send_aborts);
+  RUN_TEST(test_timestamp);
+  RUN_TEST(test_parse_requests);
+  return UNITY_END();
+}
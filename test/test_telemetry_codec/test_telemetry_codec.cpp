@@ -0,0 +1,179 @@
+#include <unity.h>
+
+#include "telemetry_codec.h"
+
+static const telemetry_channel_t channels[] = {
+  { "temperature", 100, true },
+  { "airpressure", 10, true },
+  { "humidity", 10, false },
+};
+
+static telemetry_state_t encoder, decoder;
+
+void setUp(void) {
+  telemetry_init(&encoder, channels, 3, 4);
+  telemetry_init(&decoder, channels, 3, 4);
+}
+
+void tearDown(void) {
+}
+
+static int roundtrip(const float *values, uint8_t mask, float *decoded, size_t *len) {
+  uint8_t buf[TELEMETRY_MAX_PACKET];
+  *len = telemetry_encode(&encoder, values, mask, buf, sizeof(buf));
+  TEST_ASSERT_GREATER_THAN(0, *len);
+  return telemetry_decode(&decoder, buf, *len, decoded);
+}
+
+void test_roundtrip_within_resolution(void) {
+  float decoded[3];
+  size_t len;
+
+  for (int i = 0; i < 50; i++) {
+    float values[3] = { 21.5f + i * 0.037f, 1013.2f - i * 0.31f, 45.0f + (i % 7) };
+    TEST_ASSERT_EQUAL(0x07, roundtrip(values, 0x07, decoded, &len));
+    TEST_ASSERT_FLOAT_WITHIN(0.0051, values[0], decoded[0]);
+    TEST_ASSERT_FLOAT_WITHIN(0.051, values[1], decoded[1]);
+    TEST_ASSERT_FLOAT_WITHIN(0.051, values[2], decoded[2]);
+  }
+}
+
+void test_negative_values(void) {
+  float values[3] = { -12.34f, 0, -0.05f };
+  float decoded[3];
+  size_t len;
+
+  TEST_ASSERT_EQUAL(0x07, roundtrip(values, 0x07, decoded, &len));
+  values[0] = -40.0f;
+  TEST_ASSERT_EQUAL(0x07, roundtrip(values, 0x07, decoded, &len));
+  TEST_ASSERT_FLOAT_WITHIN(0.0051, -40.0, decoded[0]);
+  TEST_ASSERT_FLOAT_WITHIN(0.051, -0.051, decoded[2]);
+}
+
+void test_keyframe_interval_and_delta_size(void) {
+  uint8_t buf[TELEMETRY_MAX_PACKET];
+  float values[3] = { 20.0f, 1000.0f, 50.0f };
+
+  for (int i = 0; i < 8; i++) {
+    size_t len = telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(i % 4 == 0, buf[0] & TELEMETRY_KEYFRAME);
+    TEST_ASSERT_EQUAL(i, buf[1]);
+    if (i % 4) {
+      // unchanged delta channels take one byte each, humidity is absolute
+      TEST_ASSERT_EQUAL(TELEMETRY_HEADER_LEN + 1 + 1 + 2, len);
+    }
+  }
+}
+
+void test_partial_mask(void) {
+  float values[3] = { 22.0f, 990.0f, 40.0f };
+  float decoded[3] = { 0, 0, 0 };
+  size_t len;
+
+  TEST_ASSERT_EQUAL(0x01, roundtrip(values, 0x01, decoded, &len));
+  TEST_ASSERT_FLOAT_WITHIN(0.0051, 22.0, decoded[0]);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, decoded[1]);
+  // airpressure was never sent, so this has to be a keyframe
+  uint8_t buf[TELEMETRY_MAX_PACKET];
+  values[0] = 22.5f;
+  len = telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(buf[0] & TELEMETRY_KEYFRAME);
+  TEST_ASSERT_EQUAL(0x07, telemetry_decode(&decoder, buf, len, decoded));
+  TEST_ASSERT_FLOAT_WITHIN(0.051, 990.0, decoded[1]);
+}
+
+void test_lost_packet_waits_for_keyframe(void) {
+  uint8_t buf[TELEMETRY_MAX_PACKET];
+  float values[3] = { 20.0f, 1000.0f, 50.0f };
+  float decoded[3];
+
+  size_t len = telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(0x07, telemetry_decode(&decoder, buf, len, decoded));
+
+  // lost
+  values[0] = 21.0f;
+  telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf));
+
+  // deltas are dropped, the absolute channel still comes through
+  values[0] = 22.0f;
+  len = telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(0x04, telemetry_decode(&decoder, buf, len, decoded));
+  len = telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(0x04, telemetry_decode(&decoder, buf, len, decoded));
+
+  // seq 4 is the next keyframe
+  values[0] = 23.0f;
+  len = telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(buf[0] & TELEMETRY_KEYFRAME);
+  TEST_ASSERT_EQUAL(0x07, telemetry_decode(&decoder, buf, len, decoded));
+  TEST_ASSERT_FLOAT_WITHIN(0.0051, 23.0, decoded[0]);
+}
+
+void test_malformed_packets(void) {
+  uint8_t buf[TELEMETRY_MAX_PACKET];
+  float values[3] = { 20.0f, 1000.0f, 50.0f };
+  float decoded[3];
+
+  size_t len = telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(-1, telemetry_decode(&decoder, buf, 2, decoded));
+  TEST_ASSERT_EQUAL(-1, telemetry_decode(&decoder, buf, len - 1, decoded));
+
+  uint8_t wrong_version[sizeof(buf)];
+  memcpy(wrong_version, buf, len);
+  wrong_version[0] = ((TELEMETRY_VERSION + 1) << 4) | TELEMETRY_KEYFRAME;
+  TEST_ASSERT_EQUAL(-1, telemetry_decode(&decoder, wrong_version, len, decoded));
+
+  uint8_t unknown_channel[] = { (TELEMETRY_VERSION << 4) | TELEMETRY_KEYFRAME, 0, 0x08,
+    decoder.schema, 0x02 };
+  TEST_ASSERT_EQUAL(-1, telemetry_decode(&decoder, unknown_channel, sizeof(unknown_channel), decoded));
+}
+
+void test_other_schema_is_refused(void) {
+  telemetry_channel_t changed[3] = { channels[0], channels[1], channels[2] };
+  uint8_t buf[TELEMETRY_MAX_PACKET];
+  float values[3] = { 20.0f, 1000.0f, 50.0f };
+  float decoded[3];
+
+  // the firmware changes a scale at runtime and resets its encoder
+  telemetry_init(&encoder, changed, 3, 4);
+  changed[0].scale = 10;
+  telemetry_reset(&encoder);
+  size_t len = telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(TELEMETRY_OTHER_SCHEMA, telemetry_decode(&decoder, buf, len, decoded));
+
+  // so does switching delta off
+  changed[0].scale = 100;
+  changed[1].delta = false;
+  telemetry_reset(&encoder);
+  len = telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(TELEMETRY_OTHER_SCHEMA, telemetry_decode(&decoder, buf, len, decoded));
+
+  // a decoder with the same table follows
+  telemetry_state_t follower;
+  telemetry_init(&follower, changed, 3, 4);
+  TEST_ASSERT_EQUAL(0x07, telemetry_decode(&follower, buf, len, decoded));
+  TEST_ASSERT_FLOAT_WITHIN(0.0051, 20.0, decoded[0]);
+}
+
+void test_buffer_too_small(void) {
+  uint8_t buf[TELEMETRY_HEADER_LEN + 2];
+  float values[3] = { 20.0f, 1000.0f, 50.0f };
+
+  TEST_ASSERT_EQUAL(0, telemetry_encode(&encoder, values, 0x07, buf, sizeof(buf)));
+  // a failed encode must not advance the state
+  TEST_ASSERT_EQUAL(0, encoder.seq);
+  TEST_ASSERT_EQUAL(0, encoder.known);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_roundtrip_within_resolution);
+  RUN_TEST(test_negative_values);
+  RUN_TEST(test_keyframe_interval_and_delta_size);
+  RUN_TEST(test_partial_mask);
+  RUN_TEST(test_lost_packet_waits_for_keyframe);
+  RUN_TEST(test_malformed_packets);
+  RUN_TEST(test_other_schema_is_refused);
+  RUN_TEST(test_buffer_too_small);
+  return UNITY_END();
+}
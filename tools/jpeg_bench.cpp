@@ -0,0 +1,189 @@
+// JPEG encoder benchmark for the host
+//
+// Encodes the same raw frame with jpeg_encode and with libjpeg, the
+// reference the integer DCT and the quantization tables are taken from,
+// and reports frames/s, size and the PSNR of both after decoding with
+// libjpeg:
+//
+//   g++ -O2 -Iinclude -o jpeg_bench tools/jpeg_bench.cpp src/jpeg_encoder.cpp -ljpeg
+//   ./jpeg_bench [-s WxH] [-n frames] [-q quality] [frame.yuv]
+//
+// Input is YUV422 as the camera delivers it, a test pattern without a
+// file. libjpeg runs with the islow DCT, 4:2:2 sampling and the standard
+// Huffman tables, so both encoders do the same work and the decoded
+// images should agree within rounding. A desktop libjpeg is usually
+// libjpeg-turbo with SIMD, so its frames/s are an upper bound rather than
+// what the camera driver's encoder does.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "jpeg_encoder.h"
+
+static size_t collect(void *arg, size_t, const void *data, size_t len) {
+  std::vector<uint8_t> *out = (std::vector<uint8_t> *)arg;
+  out->insert(out->end(), (const uint8_t *)data, (const uint8_t *)data + len);
+  return len;
+}
+
+static double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void make_pattern(uint8_t *p, int width, int height) {
+  srand(1);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      *p++ = (uint8_t)(x * 255 / width / 2 + y * 255 / height / 2 +
+        ((x / 40 + y / 40) & 1) * 40 + rand() % 4);
+      *p++ = (x & 1) ? (uint8_t)(128 + 60 * sin(y / 30.0)) : (uint8_t)(128 + 60 * cos(x / 40.0));
+    }
+  }
+}
+
+// libjpeg from the same YUV422 frame, chroma taken per pixel pair
+static void libjpeg_encode(const uint8_t *yuv, int width, int height, int quality,
+  std::vector<uint8_t> *out) {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  unsigned char *mem = NULL;
+  unsigned long size = 0;
+  std::vector<uint8_t> row(width * 3);
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, &mem, &size);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_YCbCr;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.dct_method = JDCT_ISLOW;
+  cinfo.comp_info[0].h_samp_factor = 2;
+  cinfo.comp_info[0].v_samp_factor = 1;
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    const uint8_t *s = yuv + cinfo.next_scanline * width * 2;
+    for (int x = 0; x < width; x += 2, s += 4) {
+      uint8_t *d = &row[x * 3];
+      d[0] = s[0]; d[1] = s[1]; d[2] = s[3];
+      d[3] = s[2]; d[4] = s[1]; d[5] = s[3];
+    }
+    JSAMPROW r = row.data();
+    jpeg_write_scanlines(&cinfo, &r, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  out->assign(mem, mem + size);
+  jpeg_destroy_compress(&cinfo);
+  free(mem);
+}
+
+// luma after decoding, raw YCbCr without color conversion
+static std::vector<uint8_t> decode_luma(const std::vector<uint8_t> &jpg) {
+  struct jpeg_decompress_struct dinfo;
+  struct jpeg_error_mgr jerr;
+  std::vector<uint8_t> luma;
+
+  dinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&dinfo);
+  jpeg_mem_src(&dinfo, jpg.data(), jpg.size());
+  jpeg_read_header(&dinfo, TRUE);
+  dinfo.out_color_space = JCS_YCbCr;
+  jpeg_start_decompress(&dinfo);
+  std::vector<uint8_t> row(dinfo.output_width * dinfo.output_components);
+  while (dinfo.output_scanline < dinfo.output_height) {
+    JSAMPROW r = row.data();
+    jpeg_read_scanlines(&dinfo, &r, 1);
+    for (unsigned int x = 0; x < dinfo.output_width; x++)
+      luma.push_back(row[x * dinfo.output_components]);
+  }
+  jpeg_finish_decompress(&dinfo);
+  jpeg_destroy_decompress(&dinfo);
+  return luma;
+}
+
+static double psnr(const uint8_t *yuv, const std::vector<uint8_t> &luma) {
+  double se = 0;
+  for (size_t i = 0; i < luma.size(); i++) {
+    int d = yuv[i * 2] - luma[i];
+    se += d * d;
+  }
+  return se ? 10 * log10(255.0 * 255.0 * luma.size() / se) : 99;
+}
+
+int main(int argc, char **argv) {
+  int width = 640, height = 480, frames = 20, quality = 80;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:n:q:")) != -1) {
+    switch (opt) {
+      case 's':
+        if (sscanf(optarg, "%dx%d", &width, &height) != 2)
+          return 1;
+        break;
+      case 'n': frames = atoi(optarg); break;
+      case 'q': quality = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-s WxH] [-n frames] [-q quality] [frame.yuv]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<uint8_t> yuv(width * height * 2);
+  if (optind < argc) {
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f || fread(yuv.data(), 1, yuv.size(), f) != yuv.size()) {
+      fprintf(stderr, "%s: not a %dx%d YUV422 frame\n", argv[optind], width, height);
+      return 1;
+    }
+    fclose(f);
+  } else {
+    make_pattern(yuv.data(), width, height);
+  }
+
+  uint8_t scratch[8 * 1024];  // POOL_SCRATCH slab size with PSRAM
+  std::vector<uint8_t> ours, theirs;
+  double start = now_us();
+  for (int n = 0; n < frames; n++) {
+    ours.clear();
+    if (!jpeg_encode(yuv.data(), width, height, JPEG_YUV422, quality, scratch,
+          sizeof(scratch), collect, &ours)) {
+      fprintf(stderr, "jpeg_encode failed\n");
+      return 1;
+    }
+  }
+  double ours_us = (now_us() - start) / frames;
+
+  start = now_us();
+  for (int n = 0; n < frames; n++)
+    libjpeg_encode(yuv.data(), width, height, quality, &theirs);
+  double theirs_us = (now_us() - start) / frames;
+
+  std::vector<uint8_t> a = decode_luma(ours), b = decode_luma(theirs);
+  size_t differ = 0;
+  int max_diff = 0;
+  for (size_t i = 0; i < a.size() && i < b.size(); i++) {
+    int d = abs(a[i] - b[i]);
+    differ += d != 0;
+    max_diff = d > max_diff ? d : max_diff;
+  }
+
+  printf("%dx%d YUV422, quality %d, %d frames\n", width, height, quality, frames);
+  printf("jpeg_encode %8.0f us %7.1f frames/s %7zu B  PSNR %.2f dB\n",
+    ours_us, 1e6 / ours_us, ours.size(), psnr(yuv.data(), a));
+  printf("libjpeg     %8.0f us %7.1f frames/s %7zu B  PSNR %.2f dB\n",
+    theirs_us, 1e6 / theirs_us, theirs.size(), psnr(yuv.data(), b));
+  printf("decoded luma: %zu of %zu pixels differ, by at most %d\n", differ, a.size(), max_diff);
+  return 0;
+}
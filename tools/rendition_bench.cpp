@@ -0,0 +1,137 @@
+// Rendition encode benchmark for the host
+//
+// Encodes the renditions of the firmware, full frame at quality 80 and a
+// 1/4 thumbnail at quality 60, from one raw frame the way rendition_new
+// does, and reports the time per rendition and per frame:
+//
+//   g++ -O2 -Iinclude -o rendition_bench tools/rendition_bench.cpp src/jpeg_encoder.cpp
+//   ./rendition_bench [-s WxH] [-n frames] [-f yuv422|rgb565|gray] [frame.raw]
+//
+// Without a file a test pattern is used. A raw file holds one frame as
+// the camera delivers it in the given size and format.
+// Host times are not device times, but the ratio between the renditions
+// and against the full frame carries over and tells what a thumbnail costs
+// on top of the stream.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "jpeg_encoder.h"
+
+typedef struct {
+  const char *name;
+  uint8_t quality;
+  uint8_t scale;
+} rendition_config_t;
+
+static const rendition_config_t renditions[] = {
+  { "full", 80, 1 },
+  { "thumb", 60, 4 },
+};
+#define RENDITION_COUNT (sizeof(renditions) / sizeof(renditions[0]))
+
+static size_t count(void *arg, size_t, const void *, size_t len) {
+  *(size_t *)arg += len;
+  return len;
+}
+
+static double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void make_pattern(uint8_t *p, int width, int height, int bpp) {
+  srand(1);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      // smooth gradients, a few edges and a little sensor noise
+      uint8_t v = (uint8_t)(x * 255 / width / 2 + y * 255 / height / 2 +
+        ((x / 40 + y / 40) & 1) * 40 + rand() % 4);
+      for (int b = 0; b < bpp; b++)
+        *p++ = b ? (uint8_t)(v + 64 * b) : v;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  int width = 640, height = 480, frames = 20;
+  int format = JPEG_YUV422;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:n:f:")) != -1) {
+    switch (opt) {
+      case 's':
+        if (sscanf(optarg, "%dx%d", &width, &height) != 2)
+          return 1;
+        break;
+      case 'n': frames = atoi(optarg); break;
+      case 'f':
+        format = !strcmp(optarg, "rgb565") ? JPEG_RGB565 :
+          !strcmp(optarg, "gray") ? JPEG_GRAYSCALE : JPEG_YUV422;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-s WxH] [-n frames] [-f yuv422|rgb565|gray] [frame.raw]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  int bpp = format == JPEG_GRAYSCALE ? 1 : 2;
+  std::vector<uint8_t> frame(width * height * bpp);
+  std::vector<uint8_t> raw(frame.size());
+  uint8_t scratch[8 * 1024];  // POOL_SCRATCH slab size with PSRAM
+
+  if (optind < argc) {
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f || fread(frame.data(), 1, frame.size(), f) != frame.size()) {
+      fprintf(stderr, "%s: not a %dx%d frame\n", argv[optind], width, height);
+      return 1;
+    }
+    fclose(f);
+  } else {
+    make_pattern(frame.data(), width, height, bpp);
+  }
+
+  double us[RENDITION_COUNT] = { 0 };
+  size_t bytes[RENDITION_COUNT] = { 0 };
+  double subsample_us = 0;
+
+  for (int n = 0; n < frames; n++) {
+    for (size_t r = 0; r < RENDITION_COUNT; r++) {
+      const uint8_t *src = frame.data();
+      uint16_t w = width, h = height;
+      double start = now_us();
+
+      if (renditions[r].scale > 1) {
+        if (!jpeg_subsample(frame.data(), width, height, format, renditions[r].scale,
+              raw.data(), raw.size(), &w, &h))
+          return 1;
+        subsample_us += now_us() - start;
+        src = raw.data();
+      }
+      size_t len = 0;
+      if (!jpeg_encode(src, w, h, format, renditions[r].quality, scratch, sizeof(scratch), count, &len)) {
+        fprintf(stderr, "encoding %s failed\n", renditions[r].name);
+        return 1;
+      }
+      us[r] += now_us() - start;
+      bytes[r] += len;
+    }
+  }
+
+  double total = 0;
+  printf("%dx%d, %d frames\n", width, height, frames);
+  for (size_t r = 0; r < RENDITION_COUNT; r++) {
+    total += us[r];
+    printf("%-6s q%-3d 1/%d  %8.0f us  %7zu B\n", renditions[r].name, renditions[r].quality,
+      renditions[r].scale, us[r] / frames, bytes[r] / frames);
+  }
+  printf("subsample        %8.0f us\n", subsample_us / frames);
+  printf("per frame        %8.0f us, %.1f frames/s, thumbnail adds %.0f%%\n",
+    total / frames, frames * 1e6 / total, 100.0 * us[1] / us[0]);
+  return 0;
+}
@@ -0,0 +1,432 @@
+// RTSP test server for the host
+//
+// Runs the RTP/JPEG packetizer and RTSP parser of the firmware against
+// JPEG files instead of the camera, so stream problems can be chased with
+// a stock client and a packet capture on the desk:
+//
+//   g++ -O2 -Iinclude -o rtsp_server tools/rtsp_server.cpp src/rtsp_jpeg.cpp src/jpeg_encoder.cpp
+//   ./rtsp_server [-p port] [-f fps] [frame.jpg ...]
+//   ffplay rtsp://localhost:8554/
+//   ffplay -rtsp_transport tcp rtsp://localhost:8554/
+//   vlc rtsp://localhost:8554/
+//   ./rtsp_server -t seconds [frame.jpg ...]
+//
+// The files are sent in a loop. Without files a moving test pattern is
+// encoded with jpeg_encoder. Like the firmware it serves one client at a
+// time, over UDP or interleaved in the RTSP connection.
+//
+// -t needs no client: it reports the parsing and packetization cost per
+// frame without any I/O, then the cost and throughput of interleaved
+// sends into a socket a child process drains, each for half the time.
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "jpeg_encoder.h"
+#include "rtsp_jpeg.h"
+
+#define RTSP_MTU 1400
+#define RTSP_REQUEST_LEN 1024
+#define PATTERN_WIDTH 320
+#define PATTERN_HEIGHT 240
+
+static std::vector<std::vector<uint8_t> > frames;
+static int client = -1;
+static int rtp_fd = -1;
+static struct sockaddr_in rtp_addr;
+static rtp_session_t rtp_session;
+static uint32_t session_id;
+static bool playing = false;
+static unsigned long sent_frames = 0, sent_packets = 0;
+
+static bool read_file(const char *name, std::vector<uint8_t> *out) {
+  FILE *f = fopen(name, "rb");
+  if (!f)
+    return false;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    out->insert(out->end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+static size_t collect(void *arg, size_t, const void *data, size_t len) {
+  std::vector<uint8_t> *out = (std::vector<uint8_t> *)arg;
+  out->insert(out->end(), (const uint8_t *)data, (const uint8_t *)data + len);
+  return len;
+}
+
+// diagonal bars moving one step per frame, YUV422 as the camera delivers it
+static void make_pattern(int count) {
+  static uint8_t yuv[PATTERN_WIDTH * PATTERN_HEIGHT * 2];
+  uint8_t buf[4096];
+
+  for (int n = 0; n < count; n++) {
+    for (int y = 0; y < PATTERN_HEIGHT; y++) {
+      for (int x = 0; x < PATTERN_WIDTH; x++) {
+        uint8_t *p = yuv + (y * PATTERN_WIDTH + x) * 2;
+        p[0] = (x & 1) ? (uint8_t)(128 + y / 2) : (uint8_t)(255 - x * 255 / PATTERN_WIDTH);
+        p[1] = (uint8_t)((x + y + n * 8) & 0x40 ? 220 : 40);
+      }
+    }
+    std::vector<uint8_t> jpg;
+    if (!jpeg_encode(yuv, PATTERN_WIDTH, PATTERN_HEIGHT, JPEG_YUV422, 80, buf, sizeof(buf), collect, &jpg)) {
+      fprintf(stderr, "pattern encoding failed\n");
+      exit(1);
+    }
+    frames.push_back(jpg);
+  }
+}
+
+static bool write_all(int fd, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (len) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool rtp_send_udp(void *, const uint8_t *header, size_t header_len,
+  const uint8_t *payload, size_t payload_len) {
+  struct iovec iov[2] = { { (void *)header, header_len }, { (void *)payload, payload_len } };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &rtp_addr;
+  msg.msg_namelen = sizeof(rtp_addr);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  return sendmsg(rtp_fd, &msg, 0) == (ssize_t)(header_len + payload_len);
+}
+
+// header and payload in one call without a copy, as on the device
+static bool rtp_send_tcp(void *, const uint8_t *header, size_t header_len,
+  const uint8_t *payload, size_t payload_len) {
+  struct iovec iov[2] = { { (void *)header, header_len }, { (void *)payload, payload_len } };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+
+  while (msg.msg_iovlen) {
+    ssize_t n = sendmsg(client, &msg, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    while (msg.msg_iovlen && (size_t)n >= msg.msg_iov->iov_len) {
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen) {
+      msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+static void rtsp_stop() {
+  if (client >= 0)
+    close(client);
+  client = -1;
+  playing = false;
+  printf("session ended, %lu frames, %lu packets\n", sent_frames, sent_packets);
+}
+
+static void rtsp_reply(const rtsp_request_t *r, const char *status, const char *headers) {
+  char buf[384];
+  int n = snprintf(buf, sizeof(buf), "RTSP/1.0 %s\r\nCSeq: %d\r\n%s\r\n", status, r->cseq, headers);
+  write_all(client, buf, n);
+}
+
+static void rtsp_handle(const rtsp_request_t *r) {
+  char headers[256];
+
+  switch (r->method) {
+    case RTSP_OPTIONS:
+      rtsp_reply(r, "200 OK", "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN\r\n");
+      break;
+    case RTSP_DESCRIBE: {
+      char sdp[200];
+      int n = snprintf(sdp, sizeof(sdp),
+        "v=0\r\no=- %lu 1 IN IP4 127.0.0.1\r\ns=rtsp_server\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\n"
+        "m=video 0 RTP/AVP 26\r\na=control:track1\r\n",
+        (unsigned long)rtp_session.ssrc);
+      snprintf(headers, sizeof(headers),
+        "Content-Type: application/sdp\r\nContent-Length: %d\r\n", n);
+      rtsp_reply(r, "200 OK", headers);
+      write_all(client, sdp, n);
+      break;
+    }
+    case RTSP_SETUP:
+      session_id = (uint32_t)random();
+      if (r->tcp) {
+        rtp_session.interleaved = r->interleaved[0];
+        snprintf(headers, sizeof(headers),
+          "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\nSession: %08lx\r\n",
+          r->interleaved[0], r->interleaved[1], (unsigned long)session_id);
+      } else if (r->client_port[0]) {
+        socklen_t len = sizeof(rtp_addr);
+        getpeername(client, (struct sockaddr *)&rtp_addr, &len);
+        rtp_addr.sin_port = htons(r->client_port[0]);
+        rtp_session.interleaved = -1;
+        snprintf(headers, sizeof(headers),
+          "Transport: RTP/AVP;unicast;client_port=%d-%d\r\nSession: %08lx\r\n",
+          r->client_port[0], r->client_port[1], (unsigned long)session_id);
+      } else {
+        rtsp_reply(r, "461 Unsupported Transport", "");
+        break;
+      }
+      rtsp_reply(r, "200 OK", headers);
+      break;
+    case RTSP_PLAY:
+      snprintf(headers, sizeof(headers), "Session: %08lx\r\nRange: npt=0.000-\r\n",
+        (unsigned long)session_id);
+      rtsp_reply(r, "200 OK", headers);
+      playing = true;
+      printf("playing over %s\n", rtp_session.interleaved < 0 ? "UDP" : "TCP");
+      break;
+    case RTSP_TEARDOWN:
+      snprintf(headers, sizeof(headers), "Session: %08lx\r\n", (unsigned long)session_id);
+      rtsp_reply(r, "200 OK", headers);
+      rtsp_stop();
+      break;
+    default:
+      rtsp_reply(r, "501 Not Implemented", "");
+      break;
+  }
+}
+
+// same framing as rtsp_read in the firmware: requests end in an empty
+// line, interleaved RTCP from the client is skipped
+static void rtsp_read() {
+  static std::string request;
+  static size_t skip = 0;
+  uint8_t buf[512];
+
+  ssize_t n = recv(client, buf, sizeof(buf), 0);
+  if (n <= 0) {
+    request.clear();
+    skip = 0;
+    rtsp_stop();
+    return;
+  }
+  for (ssize_t i = 0; i < n && client >= 0; i++) {
+    if (skip) {
+      skip--;
+      continue;
+    }
+    if (request.empty() && buf[i] == '$') {
+      // channel and length may straddle reads, keep it simple and take the
+      // length when it is there
+      if (i + 3 < n)
+        skip = 3 + ((buf[i + 2] << 8) | buf[i + 3]);
+      continue;
+    }
+    request += (char)buf[i];
+    if (request.size() > RTSP_REQUEST_LEN) {
+      fprintf(stderr, "request too long\n");
+      request.clear();
+      rtsp_stop();
+      return;
+    }
+    if (request.size() >= 4 && !request.compare(request.size() - 4, 4, "\r\n\r\n")) {
+      rtsp_request_t r;
+      if (rtsp_parse_request(request.c_str(), request.size(), &r))
+        rtsp_handle(&r);
+      request.clear();
+    }
+  }
+}
+
+static void rtsp_send_frame() {
+  const std::vector<uint8_t> &jpg = frames[sent_frames % frames.size()];
+  rtp_jpeg_frame_t frame;
+  struct timeval now;
+
+  if (!rtp_jpeg_parse(jpg.data(), jpg.size(), &frame)) {
+    fprintf(stderr, "frame %lu is no baseline JPEG RTP can carry\n", sent_frames % frames.size());
+    rtsp_stop();
+    return;
+  }
+  gettimeofday(&now, NULL);
+  int packets = rtp_jpeg_send(&rtp_session, &frame, rtp_timestamp(now.tv_sec, now.tv_usec),
+    RTSP_MTU, rtp_session.interleaved < 0 ? rtp_send_udp : rtp_send_tcp, NULL);
+  if (packets > 0) {
+    sent_frames++;
+    sent_packets += packets;
+  } else if (rtp_session.interleaved >= 0) {
+    rtsp_stop();
+  }
+}
+
+static double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static bool count_packet(void *arg, const uint8_t *, size_t header_len,
+  const uint8_t *, size_t payload_len) {
+  *(unsigned long *)arg += header_len + payload_len;
+  return true;
+}
+
+// frames of the loop through send for seconds, false if one fails
+static bool time_frames(const char *name, double seconds, rtp_send_cb send) {
+  unsigned long count = 0, packets = 0, bytes = 0, payload = 0;
+  double start = now_us(), elapsed;
+
+  do {
+    const std::vector<uint8_t> &jpg = frames[count % frames.size()];
+    rtp_jpeg_frame_t frame;
+    if (!rtp_jpeg_parse(jpg.data(), jpg.size(), &frame)) {
+      fprintf(stderr, "frame %lu is no baseline JPEG RTP can carry\n", count % frames.size());
+      return false;
+    }
+    int n = rtp_jpeg_send(&rtp_session, &frame, count * (RTP_CLOCK / 10), RTSP_MTU,
+      send ? send : count_packet, &bytes);
+    if (n <= 0) {
+      fprintf(stderr, "%s failed\n", name);
+      return false;
+    }
+    packets += n;
+    payload += jpg.size();
+    count++;
+    elapsed = now_us() - start;
+  } while (elapsed < seconds * 1e6);
+
+  printf("%-12s %6lu frames, %5.1f packets/frame, %7.1f us/frame, %7.1f MB/s of JPEG\n",
+    name, count, (double)packets / count, elapsed / count, payload / elapsed);
+  return true;
+}
+
+static int timing(double seconds) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    perror("socketpair");
+    return 1;
+  }
+  pid_t child = fork();
+  if (child == 0) {
+    char buf[65536];
+    close(fds[0]);
+    while (read(fds[1], buf, sizeof(buf)) > 0)
+      ;
+    _exit(0);
+  }
+  close(fds[1]);
+
+  printf("%zu frames, %zu bytes first\n", frames.size(), frames[0].size());
+  rtp_session.interleaved = -1;
+  bool ok = time_frames("packetize", seconds / 2, NULL);
+  client = fds[0];
+  rtp_session.interleaved = 0;
+  ok = ok && time_frames("interleaved", seconds / 2, rtp_send_tcp);
+  close(fds[0]);
+  client = -1;
+  waitpid(child, NULL, 0);
+  return ok ? 0 : 1;
+}
+
+static unsigned long now_ms() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000UL + tv.tv_usec / 1000;
+}
+
+int main(int argc, char **argv) {
+  int port = 8554;
+  int fps = 10;
+  double seconds = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:f:t:")) != -1) {
+    switch (opt) {
+      case 'p': port = atoi(optarg); break;
+      case 'f': fps = atoi(optarg); break;
+      case 't': seconds = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-p port] [-f fps] [frame.jpg ...]\n"
+          "       %s -t seconds [frame.jpg ...]\n", argv[0], argv[0]);
+        return 1;
+    }
+  }
+  for (int i = optind; i < argc; i++) {
+    std::vector<uint8_t> jpg;
+    if (!read_file(argv[i], &jpg)) {
+      perror(argv[i]);
+      return 1;
+    }
+    frames.push_back(jpg);
+  }
+  if (frames.empty())
+    make_pattern(16);
+  if (fps < 1)
+    fps = 1;
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  signal(SIGPIPE, SIG_IGN);
+  srandom(time(NULL));
+  rtp_session.seq = 0;
+  rtp_session.ssrc = (uint32_t)random();
+  rtp_session.interleaved = -1;
+  if (seconds > 0)
+    return timing(seconds);
+
+  int server = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server, 1) < 0) {
+    perror("rtsp socket");
+    return 1;
+  }
+  rtp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  printf("rtsp://localhost:%d/ serving %zu frames at %d fps\n", port, frames.size(), fps);
+
+  unsigned long last_frame = 0;
+  for (;;) {
+    struct pollfd p;
+    p.fd = client >= 0 ? client : server;
+    p.events = POLLIN;
+    if (poll(&p, 1, 5) > 0) {
+      if (client < 0) {
+        client = accept(server, NULL, NULL);
+        if (client >= 0) {
+          // interleaved frames end in a short packet, do not let Nagle hold it back
+          setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+          sent_frames = sent_packets = 0;
+          printf("client connected\n");
+        }
+      } else {
+        rtsp_read();
+      }
+    }
+    if (client >= 0 && playing && now_ms() - last_frame >= 1000UL / fps) {
+      last_frame = now_ms();
+      rtsp_send_frame();
+    }
+  }
+}
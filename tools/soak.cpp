@@ -0,0 +1,714 @@
+// Soak harness for the host
+//
+// Loads "/" of a running camera over several connections, polls /diag for
+// the heap samples the firmware takes and writes a report with the least
+// squares trend per hour. Two reports, e.g. from the same run against the
+// build before and after a change, are compared field by field:
+//
+//   g++ -O2 -pthread -o soak tools/soak.cpp
+//   ./soak [-n connections] [-m minutes] [-i poll_s] [-o report]
+//     [-q broker[:port] [-T topic] [-r ms] [-x port] [-d s]] host[:port]
+//   ./soak -s B/s [-n connections] [-m minutes] [-o report] host[:port]
+//   ./soak -c [-t B/h] [-b blocks/h] base.txt new.txt
+//
+// With -s the run has two halves of the same length, the fast clients
+// alone and then next to one client that reads its image at B/s through
+// a small receive buffer, so it holds a worker for as long as that takes.
+// The report gives throughput and tail latency of the fast clients in
+// both halves.
+//
+// The firmware samples the heap every soak_interval seconds and keeps the
+// last 48 samples, the harness collects all of them for the whole run.
+// Shorten the sample interval with "soak interval <s>" for short runs.
+//
+// With -q the harness also floods the device with commands through a local
+// broker, e.g. mosquitto, one every -r ms (default 100) from a fixed mix
+// and seed, published to -T, the device name (default esp-camera). It
+// first sends "soak rate 0", "soak disconnect 0" and "soak start", so the
+// device only adds captures, and "soak stop" at the end. With -x the
+// harness listens on that port and relays MQTT to the broker, dropping
+// every relayed connection each -d seconds (default 60); point the
+// device's mqttserver and mqttport at it to cycle its broker connection.
+// The commands then start once the device has connected through it.
+//
+// Compare exits with 1 when free heap or the largest free block drop
+// faster than in the base report by more than -t B/h (default 256), the
+// allocated block count grows faster by more than -b per hour (default 2)
+// or the device rebooted more often, so it can gate a build.
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SAMPLE_FIELDS 7
+#define SLOW_RCVBUF 2048
+#define SLOW_TICK_MS 100
+#define MQTT_KEEPALIVE 60  // s
+
+typedef struct {
+  double v[SAMPLE_FIELDS];  // uptime_s free min_free largest blocks loop_max_ms http_p95_ms
+} sample_t;
+
+static const char *sample_names[SAMPLE_FIELDS] = {
+  "uptime", "free", "min_free", "largest", "blocks", "loop_max", "http_p95"
+};
+
+static const char *host = NULL;
+static const char *port = "80";
+static const char *broker_host = NULL;
+static const char *broker_port = "1883";
+static const char *mqtt_topic = "esp-camera";
+static int mqtt_rate = 100;    // ms between commands
+static int proxy_port = 0;
+static int proxy_cycle = 60;   // s between dropped broker connections
+static std::atomic<bool> running(true);
+static std::atomic<unsigned long> requests(0), errors(0), bytes(0);
+static std::atomic<unsigned long> mqtt_commands(0), mqtt_errors(0);
+static std::atomic<unsigned long> proxy_connections(0), proxy_disconnects(0);
+static std::mutex latency_lock;
+static std::vector<double> latencies;
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// a connected socket with 10 s timeouts, -1 on failure; rcvbuf is set
+// before connect, so the window the server sees is small from the start
+static int connect_target(const char *host, const char *port, int rcvbuf) {
+  struct addrinfo hints, *ai;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &ai))
+    return -1;
+  int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  if (fd >= 0) {
+    struct timeval tv = { 10, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (rcvbuf)
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(ai);
+  return fd;
+}
+
+static bool send_all(int fd, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (len) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+// one GET with Connection: close, the body is read to the end because the
+// capture fallback sends no Content-Length
+static bool http_get(const char *path, std::string *body) {
+  int fd = connect_target(host, port, 0);
+  bool ok = fd >= 0;
+
+  std::string response;
+  if (ok) {
+    char buf[4096];
+    int n = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+      path, host);
+    ok = send_all(fd, buf, n);
+    while (ok && (n = recv(fd, buf, sizeof(buf), 0)) > 0)
+      response.append(buf, n);
+    ok = ok && n == 0;
+  }
+  if (fd >= 0)
+    close(fd);
+
+  ok = ok && response.compare(0, 12, "HTTP/1.1 200") == 0;
+  size_t header_end = response.find("\r\n\r\n");
+  if (ok && body)
+    *body = header_end == std::string::npos ? "" : response.substr(header_end + 4);
+  bytes += response.size();
+  return ok;
+}
+
+static void load(void) {
+  std::vector<double> mine;
+
+  while (running) {
+    double start = now_ms();
+    if (!http_get("/", NULL)) {
+      errors++;
+      usleep(200000);
+    }
+    mine.push_back(now_ms() - start);
+    requests++;
+  }
+  std::lock_guard<std::mutex> guard(latency_lock);
+  latencies.insert(latencies.end(), mine.begin(), mine.end());
+}
+
+// MQTT 3.1.1, just enough to publish at QoS 0
+typedef struct {
+  const char *command;
+  unsigned int weight;
+} soak_command_t;
+
+// the mix of soak_commands in the firmware
+static const soak_command_t soak_commands[] = {
+  { "telemetry", 10 },
+  { "loop", 10 },
+  { "pool", 10 },
+  { "outbox", 10 },
+  { "http", 5 },
+  { "ws", 5 },
+  { "rtsp", 5 },
+  { "rendition", 5 },
+  { "encoder", 5 },
+  { "clip", 5 },
+  { "power", 5 },
+  { "config", 5 },
+  { "display temperature", 5 },
+  { "display soak test in progress", 5 },
+};
+#define SOAK_COMMAND_COUNT (sizeof(soak_commands) / sizeof(soak_commands[0]))
+
+static size_t mqtt_put_string(uint8_t *p, const char *s, size_t len) {
+  p[0] = len >> 8;
+  p[1] = len & 0xff;
+  memcpy(p + 2, s, len);
+  return 2 + len;
+}
+
+// fixed header with the remaining length, then the body
+static bool mqtt_packet(int fd, uint8_t type, const uint8_t *body, size_t len) {
+  uint8_t buf[512];
+  size_t n = 0, rest = len;
+
+  buf[n++] = type;
+  do {
+    buf[n] = rest & 0x7f;
+    rest >>= 7;
+    if (rest)
+      buf[n] |= 0x80;
+    n++;
+  } while (rest);
+  if (n + len > sizeof(buf))
+    return false;
+  memcpy(buf + n, body, len);
+  return send_all(fd, buf, n + len);
+}
+
+// a session with the broker, -1 if it is not accepted
+static int mqtt_connect(const char *client_id) {
+  int fd = connect_target(broker_host, broker_port, 0);
+  if (fd < 0)
+    return -1;
+
+  uint8_t body[128], ack[4];
+  size_t n = mqtt_put_string(body, "MQTT", 4);
+  body[n++] = 4;     // protocol level 3.1.1
+  body[n++] = 0x02;  // clean session
+  body[n++] = MQTT_KEEPALIVE >> 8;
+  body[n++] = MQTT_KEEPALIVE & 0xff;
+  n += mqtt_put_string(body + n, client_id, strlen(client_id));
+  if (!mqtt_packet(fd, 0x10, body, n) || recv(fd, ack, sizeof(ack), MSG_WAITALL) != 4 ||
+      ack[0] != 0x20 || ack[3] != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool mqtt_send(int fd, const char *topic, const char *payload) {
+  uint8_t body[256];
+  size_t topic_len = strlen(topic), payload_len = strlen(payload);
+
+  if (2 + topic_len + payload_len > sizeof(body))
+    return false;
+  size_t n = mqtt_put_string(body, topic, topic_len);
+  memcpy(body + n, payload, payload_len);
+  return mqtt_packet(fd, 0x30, body, n + payload_len);
+}
+
+// commands from the firmware's mix to the device, the same sequence in
+// every run; the device's own flood and disconnects are switched off
+static void mqtt_flood(double minutes) {
+  unsigned int seed = 1, total = 0;
+  char start[32];
+  bool started = false;
+  int fd = -1;
+
+  for (unsigned int i = 0; i < SOAK_COMMAND_COUNT; i++)
+    total += soak_commands[i].weight;
+  snprintf(start, sizeof(start), "soak start %.0f", minutes < 1 ? 1 : ceil(minutes));
+
+  double next = now_ms();
+  while (running) {
+    if (fd < 0 && (fd = mqtt_connect("soak-harness")) < 0) {
+      mqtt_errors++;
+      usleep(1000000);
+      continue;
+    }
+    // through the relay the device only hears commands once it is back
+    if (!started && proxy_port && !proxy_connections) {
+      usleep(100000);
+      continue;
+    }
+    if (!started && proxy_port)
+      usleep(1000000);  // time to subscribe
+    if (!started && !(started = mqtt_send(fd, mqtt_topic, "soak rate 0") &&
+          mqtt_send(fd, mqtt_topic, "soak disconnect 0") && mqtt_send(fd, mqtt_topic, start))) {
+      mqtt_errors++;
+      close(fd);
+      fd = -1;
+      continue;
+    }
+
+    unsigned int pick = rand_r(&seed) % total, i = 0;
+    while (pick >= soak_commands[i].weight) {
+      pick -= soak_commands[i].weight;
+      i++;
+    }
+    if (!mqtt_send(fd, mqtt_topic, soak_commands[i].command)) {
+      mqtt_errors++;
+      close(fd);
+      fd = -1;
+      continue;
+    }
+    mqtt_commands++;
+    if (next < now_ms() - 1000)
+      next = now_ms();  // after a wait for the device, do not catch up
+    next += mqtt_rate;
+    double wait = next - now_ms();
+    if (wait > 0)
+      usleep(wait * 1000);
+  }
+  if (fd < 0)
+    fd = mqtt_connect("soak-harness");
+  if (fd >= 0) {
+    mqtt_send(fd, mqtt_topic, "soak stop");
+    close(fd);
+  }
+}
+
+static int listen_on(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  struct sockaddr_in addr;
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+    perror("proxy socket");
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// relays the device's MQTT connection to the broker and drops every
+// relayed connection each proxy_cycle seconds, as a broker restart would
+static void mqtt_proxy(int listen_fd) {
+  std::vector<int> fds;  // device, broker, device, broker, ...
+  double next_drop = now_ms() + proxy_cycle * 1000.0;
+
+  while (running) {
+    std::vector<struct pollfd> p(1 + fds.size());
+    p[0].fd = listen_fd;
+    p[0].events = POLLIN;
+    for (size_t i = 0; i < fds.size(); i++) {
+      p[i + 1].fd = fds[i];
+      p[i + 1].events = POLLIN;
+    }
+    if (poll(&p[0], p.size(), 100) > 0) {
+      for (size_t i = 0; i + 1 < p.size(); i++) {
+        char buf[4096];
+        if (fds[i] < 0 || !(p[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+          continue;
+        ssize_t n = recv(fds[i], buf, sizeof(buf), 0);
+        if (n <= 0 || !send_all(fds[i ^ 1], buf, n)) {
+          close(fds[i]);
+          close(fds[i ^ 1]);
+          fds[i] = fds[i ^ 1] = -1;
+        }
+      }
+      if (p[0].revents & POLLIN) {
+        int device = accept(listen_fd, NULL, NULL);
+        int broker = device >= 0 ? connect_target(broker_host, broker_port, 0) : -1;
+        if (broker >= 0) {
+          fds.push_back(device);
+          fds.push_back(broker);
+          proxy_connections++;
+        } else if (device >= 0) {
+          close(device);
+        }
+      }
+      fds.erase(std::remove(fds.begin(), fds.end(), -1), fds.end());
+    }
+    if (now_ms() >= next_drop) {
+      next_drop += proxy_cycle * 1000.0;
+      if (!fds.empty())
+        proxy_disconnects++;
+      for (size_t i = 0; i < fds.size(); i++)
+        close(fds[i]);
+      fds.clear();
+    }
+  }
+  for (size_t i = 0; i < fds.size(); i++)
+    close(fds[i]);
+  close(listen_fd);
+}
+
+// heap samples from /diag and its uptime, false if unreachable
+static bool poll_diag(std::vector<sample_t> *samples, double *uptime) {
+  std::string body;
+  if (!http_get("/diag", &body) || sscanf(body.c_str(), "uptime %lf s", uptime) != 1)
+    return false;
+
+  size_t pos = body.find("heap samples:");
+  if (pos == std::string::npos)
+    return true;
+  pos = body.find('\n', pos);
+  while (pos != std::string::npos && pos + 1 < body.size()) {
+    sample_t s;
+    const char *line = body.c_str() + pos + 1;
+    if (sscanf(line, "%lf %lf %lf %lf %lf %lf %lf", &s.v[0], &s.v[1], &s.v[2], &s.v[3],
+          &s.v[4], &s.v[5], &s.v[6]) != SAMPLE_FIELDS)
+      break;
+    samples->push_back(s);
+    pos = body.find('\n', pos + 1);
+  }
+  return true;
+}
+
+// least squares slope of a field over the samples, per hour, the same as
+// soak_trend in the firmware
+static double trend(const std::vector<sample_t> &samples, int field) {
+  double sx = 0, sxx = 0, sy = 0, sxy = 0;
+  size_t n = samples.size();
+
+  for (size_t i = 0; i < n; i++) {
+    double x = (samples[i].v[0] - samples[0].v[0]) / 3600.0;
+    double y = samples[i].v[field] - samples[0].v[field];
+    sx += x; sxx += x * x; sy += y; sxy += x * y;
+  }
+  double d = n * sxx - sx * sx;
+  return n < 3 || d == 0 ? 0 : (n * sxy - sx * sy) / d;
+}
+
+static double percentile(std::vector<double> &v, int p) {
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  return v[(v.size() - 1) * p / 100];
+}
+
+// one client reading "/" at rate B/s, again and again
+static void slow_reader(double rate, unsigned long *images, unsigned long *received) {
+  size_t per_tick = rate * SLOW_TICK_MS / 1000 > 1 ? rate * SLOW_TICK_MS / 1000 : 1;
+  std::vector<char> buf(per_tick);
+
+  while (running) {
+    int fd = connect_target(host, port, SLOW_RCVBUF);
+    if (fd < 0) {
+      usleep(200000);
+      continue;
+    }
+    char request[256];
+    int n = snprintf(request, sizeof(request),
+      "GET / HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", host);
+    bool ok = send(fd, request, n, MSG_NOSIGNAL) == n;
+    while (ok && running) {
+      usleep(SLOW_TICK_MS * 1000);
+      n = recv(fd, &buf[0], per_tick, MSG_DONTWAIT);
+      if (n > 0)
+        *received += n;
+      else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        break;
+    }
+    if (n == 0)
+      (*images)++;
+    close(fd);
+  }
+}
+
+// fast clients for seconds, with or without a slow reader next to them
+static void slow_phase(FILE *f, const char *name, int connections, double seconds, double rate) {
+  std::vector<std::thread> threads;
+  unsigned long images = 0, received = 0;
+
+  running = true;
+  requests = errors = bytes = 0;
+  latencies.clear();
+  if (rate > 0)
+    threads.push_back(std::thread(slow_reader, rate, &images, &received));
+  for (int i = 0; i < connections; i++)
+    threads.push_back(std::thread(load));
+  usleep(seconds * 1e6);
+  running = false;
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  fprintf(f, "%s_requests %lu\n", name, requests.load());
+  fprintf(f, "%s_errors %lu\n", name, errors.load());
+  fprintf(f, "%s_req_s %.2f\n", name, requests / seconds);
+  fprintf(f, "%s_kB_s %.1f\n", name, bytes / seconds / 1000);
+  fprintf(f, "%s_latency_ms p50 %.1f p95 %.1f p99 %.1f max %.1f\n", name,
+    percentile(latencies, 50), percentile(latencies, 95), percentile(latencies, 99),
+    percentile(latencies, 100));
+  if (rate > 0)
+    fprintf(f, "slow_client images %lu bytes %lu\n", images, received);
+  fprintf(stderr, "%s: %lu requests, %lu errors\n", name, requests.load(), errors.load());
+}
+
+static int slow_test(int connections, double minutes, double rate, const char *report) {
+  FILE *f = report ? fopen(report, "w") : stdout;
+  if (!f) {
+    perror(report);
+    return 1;
+  }
+  fprintf(f, "target %s:%s\n", host, port);
+  fprintf(f, "connections %d\n", connections);
+  fprintf(f, "slow_rate_B_s %.0f\n", rate);
+  slow_phase(f, "alone", connections, minutes * 30, 0);
+  slow_phase(f, "with_slow", connections, minutes * 30, rate);
+  if (report)
+    fclose(f);
+  return 0;
+}
+
+static int soak(int connections, double minutes, int poll_s, const char *report) {
+  std::map<double, sample_t> samples;  // by uptime, polls overlap
+  double last_uptime = 0;
+  unsigned int reboots = 0, polls_failed = 0;
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < connections; i++)
+    threads.push_back(std::thread(load));
+  if (proxy_port) {
+    int fd = listen_on(proxy_port);
+    if (fd < 0) {
+      running = false;
+      for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+      return 1;
+    }
+    threads.push_back(std::thread(mqtt_proxy, fd));
+  }
+  if (broker_host)
+    threads.push_back(std::thread(mqtt_flood, minutes));
+
+  double start = now_ms(), next_poll = start;
+  while (now_ms() - start < minutes * 60000.0) {
+    if (now_ms() >= next_poll) {
+      std::vector<sample_t> polled;
+      double uptime;
+      next_poll += poll_s * 1000.0;
+      if (!poll_diag(&polled, &uptime)) {
+        polls_failed++;
+      } else {
+        // after a reboot the trend only covers the current boot
+        if (uptime < last_uptime) {
+          reboots++;
+          samples.clear();
+          fprintf(stderr, "device rebooted, uptime %.0f s\n", uptime);
+        }
+        last_uptime = uptime;
+        for (size_t i = 0; i < polled.size(); i++)
+          samples[polled[i].v[0]] = polled[i];
+        fprintf(stderr, "%.0f s: %lu requests, %lu errors, %lu commands, %lu broker drops, "
+          "%zu samples\n", (now_ms() - start) / 1000, requests.load(), errors.load(),
+          mqtt_commands.load(), proxy_disconnects.load(), samples.size());
+      }
+    }
+    usleep(100000);
+  }
+  running = false;
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  std::vector<sample_t> kept;
+  for (std::map<double, sample_t>::iterator it = samples.begin(); it != samples.end(); ++it)
+    kept.push_back(it->second);
+
+  FILE *f = report ? fopen(report, "w") : stdout;
+  if (!f) {
+    perror(report);
+    return 1;
+  }
+  fprintf(f, "target %s:%s\n", host, port);
+  fprintf(f, "duration_s %.0f\n", (now_ms() - start) / 1000);
+  fprintf(f, "connections %d\n", connections);
+  fprintf(f, "requests %lu\n", requests.load());
+  fprintf(f, "errors %lu\n", errors.load());
+  fprintf(f, "bytes %lu\n", bytes.load());
+  if (broker_host) {
+    fprintf(f, "mqtt_commands %lu\n", mqtt_commands.load());
+    fprintf(f, "mqtt_errors %lu\n", mqtt_errors.load());
+  }
+  if (proxy_port) {
+    fprintf(f, "proxy_connections %lu\n", proxy_connections.load());
+    fprintf(f, "proxy_disconnects %lu\n", proxy_disconnects.load());
+  }
+  fprintf(f, "latency_ms p50 %.1f p95 %.1f p99 %.1f max %.1f\n", percentile(latencies, 50),
+    percentile(latencies, 95), percentile(latencies, 99), percentile(latencies, 100));
+  fprintf(f, "reboots %u\n", reboots);
+  fprintf(f, "polls_failed %u\n", polls_failed);
+  fprintf(f, "samples %zu\n", kept.size());
+  for (int i = 1; i < SAMPLE_FIELDS; i++)
+    fprintf(f, "trend %s %.1f\n", sample_names[i], trend(kept, i));
+  for (size_t i = 0; i < kept.size(); i++) {
+    fprintf(f, "sample");
+    for (int j = 0; j < SAMPLE_FIELDS; j++)
+      fprintf(f, " %.0f", kept[i].v[j]);
+    fprintf(f, "\n");
+  }
+  if (report)
+    fclose(f);
+  return 0;
+}
+
+// "trend <field> <value>" and "<key> <value>" lines of a report
+static bool read_report(const char *name, std::map<std::string, double> *values) {
+  FILE *f = fopen(name, "r");
+  char line[256], key[64], field[64];
+  double v;
+
+  if (!f) {
+    perror(name);
+    return false;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "trend %63s %lf", field, &v) == 2)
+      (*values)[std::string("trend ") + field] = v;
+    else if (sscanf(line, "%63s %lf", key, &v) == 2)
+      (*values)[key] = v;
+  }
+  fclose(f);
+  return true;
+}
+
+static int compare(const char *base_name, const char *new_name, double bytes_h, double blocks_h) {
+  std::map<std::string, double> base, next;
+  if (!read_report(base_name, &base) || !read_report(new_name, &next))
+    return 2;
+
+  const struct {
+    const char *key;
+    double limit;  // allowed change in the bad direction, 0 to only report
+    int bad;       // -1 if lower is worse
+  } checks[] = {
+    { "trend free", bytes_h, -1 },
+    { "trend largest", bytes_h, -1 },
+    { "trend min_free", 0, -1 },
+    { "trend blocks", blocks_h, 1 },
+    { "trend loop_max", 0, 1 },
+    { "trend http_p95", 0, 1 },
+    { "reboots", 0.5, 1 },
+    { "errors", 0, 1 },
+    { "mqtt_errors", 0, 1 },
+  };
+  int regressions = 0;
+
+  printf("%-16s %12s %12s %12s\n", "", base_name, new_name, "change");
+  for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+    double a = base[checks[i].key], b = next[checks[i].key];
+    bool regressed = checks[i].limit > 0 && (b - a) * checks[i].bad > checks[i].limit;
+    printf("%-16s %12.1f %12.1f %+12.1f%s\n", checks[i].key, a, b, b - a,
+      regressed ? "  REGRESSION" : "");
+    regressions += regressed;
+  }
+  if (next["samples"] < 3)
+    printf("%s has %.0f samples, too few for a trend\n", new_name, next["samples"]);
+  return regressions ? 1 : 0;
+}
+
+// host[:port], the port is left alone without one
+static void split_target(char *arg, const char **h, const char **p) {
+  char *colon = strchr(arg, ':');
+  if (colon) {
+    *colon = 0;
+    *p = colon + 1;
+  }
+  *h = arg;
+}
+
+int main(int argc, char **argv) {
+  int connections = 4, poll_s = 60;
+  double minutes = 60;
+  double bytes_h = 256, blocks_h = 2, slow_rate = 0;
+  const char *report = NULL;
+  bool compare_mode = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:m:i:o:ct:b:s:q:T:r:x:d:")) != -1) {
+    switch (opt) {
+      case 'n': connections = atoi(optarg); break;
+      case 'm': minutes = atof(optarg); break;
+      case 'i': poll_s = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+      case 'o': report = optarg; break;
+      case 'c': compare_mode = true; break;
+      case 't': bytes_h = atof(optarg); break;
+      case 'b': blocks_h = atof(optarg); break;
+      case 's': slow_rate = atof(optarg); break;
+      case 'q': split_target(optarg, &broker_host, &broker_port); break;
+      case 'T': mqtt_topic = optarg; break;
+      case 'r': mqtt_rate = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+      case 'x': proxy_port = atoi(optarg); break;
+      case 'd': proxy_cycle = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-n connections] [-m minutes] [-i poll_s] [-o report]\n"
+          "         [-q broker[:port] [-T topic] [-r ms] [-x port] [-d s]] host[:port]\n"
+          "       %s -s B/s [-n connections] [-m minutes] [-o report] host[:port]\n"
+          "       %s -c [-t B/h] [-b blocks/h] base.txt new.txt\n", argv[0], argv[0], argv[0]);
+        return 2;
+    }
+  }
+
+  if (compare_mode) {
+    if (argc - optind != 2) {
+      fprintf(stderr, "compare needs two reports\n");
+      return 2;
+    }
+    return compare(argv[optind], argv[optind + 1], bytes_h, blocks_h);
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "no host\n");
+    return 2;
+  }
+  if (proxy_port && !broker_host) {
+    fprintf(stderr, "-x needs a broker\n");
+    return 2;
+  }
+  split_target(argv[optind], &host, &port);
+  if (slow_rate > 0)
+    return slow_test(connections, minutes, slow_rate, report);
+  return soak(connections, minutes, poll_s, report);
+}
@@ -0,0 +1,122 @@
+// Telemetry encoding benchmark for the host
+//
+// Feeds the firmware's channels with slowly drifting, slightly noisy
+// readings and reports the bytes per reading on the wire for the text
+// topics and for binary packets at several keyframe intervals, counted
+// the way log_telemetry does, and the encode and decode cost per packet:
+//
+//   g++ -O2 -Iinclude -o telemetry_bench tools/telemetry_bench.cpp src/telemetry_codec.cpp
+//   ./telemetry_bench [-n packets] [-s site/room]
+//
+// Host times are not device times, compare them with the encode time
+// "telemetry" logs on the device.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "telemetry_codec.h"
+
+static const telemetry_channel_t channels[] = {
+  { "temperature", 100, true },  // 0.01 C
+  { "airpressure", 10, true },   // 0.1 hPa
+  { "humidity", 10, true },      // 0.1 %
+};
+#define CHANNEL_COUNT (sizeof(channels) / sizeof(channels[0]))
+
+static double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void make_readings(std::vector<float> *readings, int packets) {
+  srand(1);
+  for (int i = 0; i < packets; i++) {
+    float noise = (rand() % 21 - 10) / 100.0f;
+    readings->push_back(21.0f + 3 * sinf(i / 500.0f) + noise / 2);   // C
+    readings->push_back(1013.0f + 8 * sinf(i / 2000.0f) + noise);   // hPa
+    readings->push_back(45.0f + 10 * sinf(i / 800.0f) + noise * 2); // %
+  }
+}
+
+int main(int argc, char **argv) {
+  int packets = 10000;
+  const char *prefix = "site/room";
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+      case 'n': packets = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+      case 's': prefix = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-n packets] [-s site/room]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<float> readings;
+  make_readings(&readings, packets);
+  // topic "/site/room/" as sent on the wire
+  size_t topic = strlen(prefix) + 2;
+  size_t readings_total = (size_t)packets * CHANNEL_COUNT;
+
+  size_t text_bytes = 0;
+  for (size_t i = 0; i < readings_total; i++) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%.3f", readings[i]);
+    text_bytes += topic + strlen(channels[i % CHANNEL_COUNT].name) + strlen(buf);
+  }
+  printf("%d packets of %zu readings, topic /%s/\n", packets, CHANNEL_COUNT, prefix);
+  printf("text               %6.2f B/reading\n", (double)text_bytes / readings_total);
+
+  const uint8_t intervals[] = { 1, 10, 60 };
+  for (size_t k = 0; k < sizeof(intervals); k++) {
+    telemetry_state_t encoder, decoder;
+    std::vector<uint8_t> wire;
+    std::vector<size_t> lengths;
+    telemetry_init(&encoder, channels, CHANNEL_COUNT, intervals[k]);
+    telemetry_init(&decoder, channels, CHANNEL_COUNT, intervals[k]);
+
+    double start = now_us();
+    for (int p = 0; p < packets; p++) {
+      uint8_t buf[TELEMETRY_MAX_PACKET];
+      size_t len = telemetry_encode(&encoder, &readings[p * CHANNEL_COUNT], 0x07, buf, sizeof(buf));
+      if (!len) {
+        fprintf(stderr, "encoding failed\n");
+        return 1;
+      }
+      wire.insert(wire.end(), buf, buf + len);
+      lengths.push_back(len);
+    }
+    double encode_us = now_us() - start;
+
+    size_t pos = 0;
+    float max_error = 0;
+    start = now_us();
+    for (int p = 0; p < packets; p++) {
+      float values[CHANNEL_COUNT];
+      if (telemetry_decode(&decoder, &wire[pos], lengths[p], values) != 0x07) {
+        fprintf(stderr, "decoding failed\n");
+        return 1;
+      }
+      pos += lengths[p];
+      for (size_t c = 0; c < CHANNEL_COUNT; c++) {
+        float e = fabsf(values[c] - readings[p * CHANNEL_COUNT + c]) * channels[c].scale;
+        max_error = e > max_error ? e : max_error;
+      }
+    }
+    double decode_us = now_us() - start;
+
+    size_t binary_bytes = (topic + strlen("telemetry")) * packets + wire.size();
+    printf("binary keyframe %-3d %5.2f B/reading, payload %4.2f B/packet, "
+      "encode %5.0f ns, decode %5.0f ns, error %.2f steps\n", intervals[k],
+      (double)binary_bytes / readings_total, (double)wire.size() / packets,
+      encode_us * 1000 / packets, decode_us * 1000 / packets, max_error);
+  }
+  return 0;
+}
@@ -0,0 +1,110 @@
+// Telemetry decoder for the host
+//
+// Decodes the binary packets the firmware publishes on the telemetry topic
+// with the same code, one packet per input line as hex, e.g. straight from
+// mosquitto_sub:
+//
+//   g++ -O2 -Iinclude -o telemetry_decode tools/telemetry_decode.cpp src/telemetry_codec.cpp
+//   mosquitto_sub -h broker -t /site/room/telemetry -F %x | ./telemetry_decode [-c name:scale[:abs]]...
+//
+// Without -c the channel table is the firmware's default. After
+// "telemetry <channel> scale|delta" on the device give the whole table
+// here, in channel order; packets with another schema are reported and
+// skipped instead of being mis-scaled. Every decoded packet prints as
+//   <seq> [key] <name>=<value> ...
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "telemetry_codec.h"
+
+static telemetry_channel_t channels[TELEMETRY_MAX_CHANNELS] = {
+  { "temperature", 100, true },  // 0.01 C
+  { "airpressure", 10, true },   // 0.1 hPa
+  { "humidity", 10, true },      // 0.1 %
+};
+static uint8_t channel_count = 3;
+
+// name:scale[:abs]
+static bool parse_channel(char *arg, telemetry_channel_t *c) {
+  char *scale = strchr(arg, ':');
+  if (!scale)
+    return false;
+  *scale++ = 0;
+  char *end;
+  c->name = arg;
+  c->scale = strtof(scale, &end);
+  c->delta = strcmp(end, ":abs") != 0;
+  return c->scale > 0 && (!*end || !c->delta);
+}
+
+static size_t parse_hex(const char *line, uint8_t *buf, size_t size) {
+  size_t n = 0;
+
+  while (isxdigit((unsigned char)line[0]) && isxdigit((unsigned char)line[1]) && n < size) {
+    char byte[3] = { line[0], line[1], 0 };
+    buf[n++] = (uint8_t)strtoul(byte, NULL, 16);
+    line += 2;
+  }
+  return *line == '\n' || *line == '\r' || !*line ? n : 0;
+}
+
+int main(int argc, char **argv) {
+  bool own_table = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:")) != -1) {
+    switch (opt) {
+      case 'c':
+        if (!own_table)
+          channel_count = 0;
+        own_table = true;
+        if (channel_count == TELEMETRY_MAX_CHANNELS ||
+            !parse_channel(optarg, &channels[channel_count++])) {
+          fprintf(stderr, "bad channel %s, expected name:scale[:abs]\n", optarg);
+          return 1;
+        }
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-c name:scale[:abs]]... < hex packets\n", argv[0]);
+        return 1;
+    }
+  }
+
+  telemetry_state_t state;
+  telemetry_init(&state, channels, channel_count, 1);
+  fprintf(stderr, "%d channels, schema %02X\n", channel_count, state.schema);
+
+  char line[2 * TELEMETRY_MAX_PACKET + 8];
+  unsigned long packets = 0, refused = 0;
+  while (fgets(line, sizeof(line), stdin)) {
+    uint8_t buf[TELEMETRY_MAX_PACKET];
+    float values[TELEMETRY_MAX_CHANNELS];
+    size_t len = parse_hex(line, buf, sizeof(buf));
+    int mask = len ? telemetry_decode(&state, buf, len, values) : -1;
+
+    packets++;
+    if (mask == TELEMETRY_OTHER_SCHEMA) {
+      refused++;
+      fprintf(stderr, "schema %02X differs from %02X, the channel settings changed\n",
+        buf[3], state.schema);
+      continue;
+    }
+    if (mask < 0) {
+      refused++;
+      fprintf(stderr, "malformed packet: %s", line);
+      continue;
+    }
+    printf("%u%s", buf[1], (buf[0] & TELEMETRY_KEYFRAME) ? " key" : "");
+    for (unsigned int i = 0; i < channel_count; i++) {
+      if (mask & (1 << i))
+        printf(" %s=%g", channels[i].name, values[i]);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+  fprintf(stderr, "%lu packets, %lu refused\n", packets, refused);
+  return 0;
+}